@@ -0,0 +1,101 @@
+/** Benchmark of heap allocations per Dictionary<string, string> operation
+ Counts calls to the global operator new during n inserts, lookups and
+ removals of 40-character keys through each entry point. Node storage comes
+ from the pool's 64 KB slabs, so its share rounds to zero and what is left
+ is the cost of the keys and infos themselves.
+ Build: g++ -std=c++17 -O2 -pthread alloc-bench.cpp
+ Usage: ./a.out [n]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size)
+{
+    allocations++;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+template <typename Function>
+void measure(const char* name, size_t ops, Function fn)
+{
+    size_t before = allocations;
+    double time = NanosecondsPerOp(ops, fn);
+    printf("%-32s %6.2f allocations/op %8.1f ns/op\n", name, double(allocations - before) / ops, time);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    // longer than any small string buffer, so every copy allocates
+    vector<string> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        char buffer[41];
+        snprintf(buffer, sizeof(buffer), "key-%036zu", (i * 2654435761u) % n);
+        keys[i] = buffer;
+    }
+    string info(40, 'i');
+
+    {
+        Dictionary<string, string> dictionary;
+        measure("insert(const Key&, const Info&)", n, [&] {
+            for (const string& key : keys)
+                dictionary.insert(key, info);
+        });
+    }
+    Dictionary<string, string> dictionary;
+    {
+        vector<string> movedKeys = keys;
+        vector<string> movedInfos(n, info);
+        measure("insert(Key&&, Info&&)", n, [&] {
+            for (size_t i = 0; i < n; i++)
+                dictionary.insert(move(movedKeys[i]), move(movedInfos[i]));
+        });
+    }
+    {
+        Dictionary<string, string> emplaced;
+        measure("emplace(const char*, n, char)", n, [&] {
+            for (const string& key : keys)
+                emplaced.emplace(key.c_str(), 40, 'i');
+        });
+        measure("try_emplace on present keys", n, [&] {
+            for (const string& key : keys)
+                emplaced.try_emplace(key, 40, 'i');
+        });
+    }
+
+    size_t found = 0;
+    measure("find(const string&)", n, [&] {
+        for (const string& key : keys)
+            found += dictionary.find(key) != nullptr;
+    });
+    measure("find(string_view)", n, [&] {
+        for (const string& key : keys)
+            found += dictionary.find(string_view(key)) != nullptr;
+    });
+    measure("find(const char*)", n, [&] {
+        for (const string& key : keys)
+            found += dictionary.find(key.c_str()) != nullptr;
+    });
+    if (found != 3 * n)
+        printf("lookups missed keys!\n");
+    measure("remove(string_view)", n, [&] {
+        for (const string& key : keys)
+            dictionary.remove(string_view(key));
+    });
+}
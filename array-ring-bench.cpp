@@ -0,0 +1,66 @@
+// Benchmark of ArrayRing against the linked Ring: pushing n elements,
+// iterating over them, FIFO churn (push one, pop one) at a fixed length, and
+// heap bytes held per element.
+// Build: g++ -std=c++17 -O2 -pthread array-ring-bench.cpp
+// Usage: ./a.out [n]
+
+#define RING_NO_MAIN
+#include "ring.cpp"
+#include "bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <malloc.h>
+
+static size_t live_bytes = 0;
+
+// usable sizes, so the figures include the allocator's rounding
+void* operator new(size_t size) {
+  void* p = malloc(size ? size : 1);
+  if (!p) throw bad_alloc();
+  live_bytes += malloc_usable_size(p);
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  live_bytes -= malloc_usable_size(p);
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+// Pops the first element of either ring
+void PopFront(Ring<int, int>& ring) { ring.Erase(ring.begin()); }
+void PopFront(ArrayRing<int, int>& ring) { ring.RemoveFirst(); }
+
+template <typename R>
+void Benchmark(const char* name, size_t n) {
+  size_t bytes_before = live_bytes;
+  R ring;
+  double push = NanosecondsPerOp(n, [&] {
+    for (size_t i = 0; i < n; i++) ring.InsertAtEnd(int(i), int(i));
+  });
+  double bytes = double(live_bytes - bytes_before) / n;
+  long sum = 0;
+  double iterate = NanosecondsPerOp(n, [&] {
+    for (auto it = ring.begin(); it != ring.end(); ++it) sum += *it;
+  });
+  double churn = NanosecondsPerOp(n, [&] {
+    for (size_t i = 0; i < n; i++) {
+      PopFront(ring);
+      ring.InsertAtEnd(int(i), int(i));
+    }
+  });
+  if (sum != long(n) * long(n - 1) / 2) printf("iteration missed elements!\n");
+  printf("%-9s push %6.1f  iterate %6.1f  churn %6.1f ns/element  ", name,
+         push, iterate, churn);
+  printf("%5.1f bytes/element\n", bytes);
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  printf("n=%zu, Ring<int, int> and ArrayRing<int, int>\n", n);
+  Benchmark<Ring<int, int>>("Ring", n);
+  Benchmark<ArrayRing<int, int>>("ArrayRing", n);
+}
@@ -4,320 +4,3570 @@
  Based on work by D. S. Malik and E. Mahendru
 **/
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "buffered-writer.h"
 
 using namespace std;
 
+// Slab allocator for tree nodes. Blocks are carved out of large slabs by a
+// bump pointer and recycled through an intrusive free list. The pool is the
+// arena of a single tree: reset() recycles every slab in O(1), release()
+// returns them to the system. When trees exchange nodes (join, split, set
+// operations) their pools are merged into one arena, which then stays alive
+// until the last of those trees lets go of it; such trees must be used from
+// one thread at a time.
+template <typename T>
+class NodePool {
+public:
+    using value_type = T;
+
+    NodePool() = default;
+
+    NodePool(const NodePool&) = delete;
+
+    NodePool& operator=(const NodePool&) = delete;
+
+    T* allocate(size_t n = 1);
+
+    void deallocate(T* p, size_t n = 1);
+
+    // true if no other pool shares the arena, i.e. reset() can't pull memory from under another tree
+    bool exclusive();
+
+    void reset();
+
+    void release();
+
+    // makes both pools allocate from one arena that owns the slabs of both
+    void merge(NodePool& other);
+
+private:
+    union Block {
+        Block* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    static constexpr size_t kBlocksPerSlab = (64 * 1024) / sizeof(Block) > 0 ? (64 * 1024) / sizeof(Block) : 1;
+
+    struct Slab {
+        Slab* next;
+        Block blocks[kBlocksPerSlab];
+    };
+
+    struct Arena {
+        Slab* slabs = nullptr; // slabs before current are full
+        Slab* current = nullptr; // slab the bump pointer is in
+        size_t used = 0; // blocks handed out from current
+        Block* free = nullptr;
+        shared_ptr<Arena> forward; // arena this one was merged into
+
+        ~Arena();
+    };
+
+    shared_ptr<Arena> arena_;
+
+    Arena& _arena();
+};
+
+// Node allocator shared by every tree of the process. Each thread keeps a
+// small cache of free blocks and only takes the central lock to exchange
+// whole batches, so trees living on different threads don't contend.
+template <typename T>
+class SharedNodePool {
+public:
+    using value_type = T;
+
+    T* allocate(size_t n = 1);
+
+    void deallocate(T* p, size_t n = 1);
+
+private:
+    union Block {
+        Block* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    static constexpr size_t kBatch = 64;
+
+    struct Central {
+        mutex lock;
+        Block* free = nullptr;
+        vector<Block*> slabs;
+
+        ~Central();
+    };
+
+    struct Cache {
+        Block* free = nullptr;
+        size_t count = 0;
+
+        ~Cache();
+    };
+
+    static Central& _central();
+
+    static void _refill(Cache& cache);
+
+    static void _flush(Cache& cache, size_t count);
+
+    static thread_local Cache cache_;
+};
+
+template <typename T>
+thread_local typename SharedNodePool<T>::Cache SharedNodePool<T>::cache_;
+
+// Allocators providing reset(), exclusive() and merge() own their memory as
+// an arena. A tree may drop all of its nodes at once instead of deallocating
+// them one by one, and nodes may move between trees once their arenas are
+// merged.
+template <typename Alloc, typename = void>
+struct is_arena : false_type {
+};
+
+template <typename Alloc>
+struct is_arena<Alloc, void_t<decltype(declval<Alloc&>().reset()), decltype(declval<Alloc&>().exclusive()), decltype(declval<Alloc&>().merge(declval<Alloc&>()))>> : true_type {
+};
+
+// Work-stealing pool for fork-join recursion. Every worker owns a deque of
+// forked tasks: it pushes and pops at the back and steals from the front of
+// other deques once its own runs dry. A thread waiting for a forked task runs
+// other tasks meanwhile, so nested forks never block a worker.
+class ForkJoinPool {
+public:
+    explicit ForkJoinPool(size_t workers = max(1u, thread::hardware_concurrency()));
+
+    ForkJoinPool(const ForkJoinPool&) = delete;
+
+    ForkJoinPool& operator=(const ForkJoinPool&) = delete;
+
+    ~ForkJoinPool();
+
+    // runs left() on the calling thread and right() on whichever thread gets to it first
+    template <typename Left, typename Right>
+    void invoke(Left&& left, Right&& right);
+
+    static ForkJoinPool& shared();
+
+private:
+    struct Task {
+        void (*call)(void*);
+        void* function;
+        atomic<bool> done { false };
+    };
+
+    struct alignas(64) Queue {
+        mutex lock;
+        deque<Task*> tasks;
+    };
+
+    vector<thread> threads_;
+    unique_ptr<Queue[]> queues_; // one per worker, the last one is shared by outside threads
+    size_t queue_count_;
+    atomic<bool> stop_ { false };
+    mutex idle_lock_;
+    condition_variable idle_;
+
+    static thread_local ForkJoinPool* current_pool_;
+    static thread_local size_t current_queue_;
+
+    size_t _queueIndex() const;
+
+    bool _popBack(size_t queue, Task* task);
+
+    Task* _steal(size_t thief);
+
+    void _run(Task* task);
+
+    void _work(size_t queue);
+};
+
+// Immutable snapshot of a Dictionary produced by freeze(). Entries are kept in
+// Eytzinger (BFS) order in flat arrays: the children of slot k are 2k and
+// 2k + 1, so the top of the search shares a few cache lines, the descent is
+// branchless and the slots a few levels down can be prefetched early.
+template <typename Key, typename Info>
+class FrozenDictionary {
+public:
+    FrozenDictionary() = default;
+
+    // keys must be strictly increasing, infos[i] belongs to keys[i]
+    FrozenDictionary(vector<Key> keys, vector<Info> infos);
+
+    size_t size() const
+    {
+        return keys_.size() - 1;
+    }
+
+    template <typename K>
+    bool contains(const K& key) const;
+
+    // nullptr if the key is missing
+    template <typename K>
+    const Info* find(const K& key) const;
+
+private:
+    vector<Key> keys_ = vector<Key>(1); // slot 0 is unused
+    vector<Info> infos_ = vector<Info>(1);
+
+    void _layout(vector<Key>& keys, vector<Info>& infos, size_t& i, size_t k);
+
+    template <typename K>
+    size_t _lowerBound(const K& key) const;
+};
+
+// How Dictionary::save() stores a key or an info and how MappedDictionary reads
+// it back. Trivially copyable values are stored in place; strings are stored
+// as an (offset, length) pair into a byte heap at the end of the file, so the
+// records stay fixed-width and the file holds no pointers.
+template <typename T, typename = void>
+struct FileCodec;
+
+template <typename T>
+struct FileCodec<T, enable_if_t<is_trivially_copyable<T>::value>> {
+    using Stored = T;
+    using View = T;
+    static constexpr uint32_t kKind = 0;
+
+    static Stored encode(const T& value, uint64_t&)
+    {
+        return value;
+    }
+
+    // bytes this value adds to the heap
+    static string_view bytes(const T&)
+    {
+        return string_view();
+    }
+
+    static bool valid(const Stored&, uint64_t)
+    {
+        return true;
+    }
+
+    static View decode(const Stored& stored, const char*)
+    {
+        return stored;
+    }
+};
+
+template <>
+struct FileCodec<string> {
+    struct Stored {
+        uint64_t offset;
+        uint64_t length;
+    };
+    using View = string_view;
+    static constexpr uint32_t kKind = 1;
+
+    static Stored encode(const string& value, uint64_t& heap_size)
+    {
+        Stored stored = { heap_size, value.size() };
+        heap_size += value.size();
+        return stored;
+    }
+
+    static string_view bytes(const string& value)
+    {
+        return value;
+    }
+
+    // whether the bytes lie inside a heap of heap_size bytes
+    static bool valid(const Stored& stored, uint64_t heap_size)
+    {
+        return stored.offset <= heap_size && stored.length <= heap_size - stored.offset;
+    }
+
+    // stored must be valid(), MappedDictionary checks every record when it maps a file
+    static View decode(const Stored& stored, const char* heap)
+    {
+        return string_view(heap + stored.offset, stored.length);
+    }
+};
+
+// File layout shared by Dictionary::save() and MappedDictionary. Every section
+// starts at a multiple of kAlignment from the beginning of the file:
+//   header
+//   keys, infos          sorted by key, size entries each
+//   index keys, index positions
+//                        every kIndexStride-th key and its position, in
+//                        Eytzinger order (slot 0 unused, index_size + 1 slots)
+//   heap                 string bytes
+struct MappedFileHeader {
+    static constexpr char kMagic[8] = { 'A', 'V', 'L', 'D', 'I', 'C', 'T', 0 };
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint64_t kAlignment = 64;
+    static constexpr uint32_t kIndexStride = 16;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t index_stride;
+    uint32_t key_kind;
+    uint32_t key_width;
+    uint32_t info_kind;
+    uint32_t info_width;
+    uint64_t size;
+    uint64_t index_size;
+    uint64_t keys_offset;
+    uint64_t infos_offset;
+    uint64_t index_keys_offset;
+    uint64_t index_positions_offset;
+    uint64_t heap_offset;
+    uint64_t heap_size;
+};
+
+// Read-only view of a file written by Dictionary::save(). open() maps the file
+// and queries run directly on the mapping: nothing is parsed or copied at
+// startup, and processes mapping the same file share its pages. The index and
+// any records holding strings are read once, to check where they point. The index
+// narrows a search to kIndexStride sorted keys, which are then searched without
+// branches. Keys and infos are returned as FileCodec views (string_view for
+// strings) that stay valid while the dictionary is open.
 template <typename Key, typename Info>
-class Dictionary {
+class MappedDictionary {
+public:
+    using KeyView = typename FileCodec<Key>::View;
+    using InfoView = typename FileCodec<Info>::View;
+
+    MappedDictionary() = default;
+
+    MappedDictionary(MappedDictionary&& other);
+
+    MappedDictionary& operator=(MappedDictionary&& other);
+
+    MappedDictionary(const MappedDictionary&) = delete;
+
+    MappedDictionary& operator=(const MappedDictionary&) = delete;
+
+    ~MappedDictionary();
+
+    // A file that is missing, truncated, corrupt or written for other key or
+    // info types gives a dictionary that is not open.
+    static MappedDictionary open(const string& path);
+
+    bool isOpen() const
+    {
+        return data_ != nullptr;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    template <typename K>
+    bool contains(const K& key) const;
+
+    // false if the key is missing
+    template <typename K>
+    bool find(const K& key, InfoView& info) const;
+
+    // number of keys smaller than key
+    template <typename K>
+    size_t rank(const K& key) const;
+
+    // number of keys in [lo, hi)
+    size_t countRange(const Key& lo, const Key& hi) const;
+
+    // calls fn(key, info) for every entry with a key in [lo, hi), in key order
+    template <typename Function>
+    void forEachInRange(const Key& lo, const Key& hi, Function fn) const;
+
+private:
+    using KeyCodec = FileCodec<Key>;
+    using InfoCodec = FileCodec<Info>;
+
+    void* data_ = nullptr;
+    size_t length_ = 0;
+    size_t size_ = 0;
+    size_t index_size_ = 0;
+    const typename KeyCodec::Stored* keys_ = nullptr;
+    const typename InfoCodec::Stored* infos_ = nullptr;
+    const typename KeyCodec::Stored* index_keys_ = nullptr;
+    const uint64_t* index_positions_ = nullptr;
+    const char* heap_ = nullptr;
+
+    bool _map(const MappedFileHeader& header);
+
+    void _unmap();
+
+    KeyView _key(size_t i) const
+    {
+        return KeyCodec::decode(keys_[i], heap_);
+    }
+
+    template <typename K>
+    size_t _lowerBound(const K& key) const;
+};
+
+// Which entry a batch keeps for a key it holds more than once. kFirstWins
+// behaves like inserting the entries one by one: keys already in the tree keep
+// their info too. With kLastWins the last entry's info replaces any other.
+enum class BatchPolicy {
+    kFirstWins,
+    kLastWins
+};
+
+// Operations whose comparisons a Dictionary stats policy counts.
+enum class DictionaryOp {
+    kFind,
+    kInsert,
+    kRemove
+};
+
+// Counters and tree shape reported by Dictionary::statsSnapshot(). The
+// counters stay zero unless the dictionary counts with DictionaryStats.
+struct DictionaryStatsSnapshot {
+    uint64_t single_rotations = 0;
+    uint64_t double_rotations = 0;
+    uint64_t operations[3] = {}; // indexed by DictionaryOp
+    uint64_t comparisons[3] = {}; // keys compared against, one per node visited
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+    size_t nodes = 0;
+    size_t node_bytes = 0;
+    vector<size_t> depth_histogram; // nodes per depth, the root is at depth 0
+};
+
+// Default stats policy of Dictionary. Dictionary derives from its policy, so
+// these empty hooks take no space and the counting around them compiles away.
+struct NoStats {
+    void countRotation(bool) const
+    {
+    }
+
+    void countOperation(DictionaryOp, size_t) const
+    {
+    }
+
+    void countAllocations(size_t) const
+    {
+    }
+
+    void countDeallocations(size_t) const
+    {
+    }
+
+    void fill(DictionaryStatsSnapshot&) const
+    {
+    }
+};
+
+// Stats policy that counts rotations, comparisons per operation and node
+// allocations. Counters are relaxed atomics: readers sharing a dictionary and
+// the halves of a parallel set operation count at the same time.
+class DictionaryStats {
+public:
+    void countRotation(bool double_rotation) const
+    {
+        (double_rotation ? double_rotations_ : single_rotations_).fetch_add(1, memory_order_relaxed);
+    }
+
+    void countOperation(DictionaryOp op, size_t comparisons) const
+    {
+        operations_[static_cast<int>(op)].fetch_add(1, memory_order_relaxed);
+        comparisons_[static_cast<int>(op)].fetch_add(comparisons, memory_order_relaxed);
+    }
+
+    void countAllocations(size_t nodes) const
+    {
+        allocations_.fetch_add(nodes, memory_order_relaxed);
+    }
+
+    void countDeallocations(size_t nodes) const
+    {
+        deallocations_.fetch_add(nodes, memory_order_relaxed);
+    }
+
+    void fill(DictionaryStatsSnapshot& snapshot) const;
+
+    void reset();
+
+private:
+    mutable atomic<uint64_t> single_rotations_ { 0 };
+    mutable atomic<uint64_t> double_rotations_ { 0 };
+    mutable atomic<uint64_t> operations_[3] = {};
+    mutable atomic<uint64_t> comparisons_[3] = {};
+    mutable atomic<uint64_t> allocations_ { 0 };
+    mutable atomic<uint64_t> deallocations_ { 0 };
+};
+
+// Default comparator of Dictionary: a three-way comparison returning a
+// negative, zero or positive int, so a search compares once per level.
+// Anything convertible to string_view is compared with a single compare()
+// call; other types go through operator<, which for arithmetic keys compiles
+// to flag arithmetic rather than branches.
+struct ThreeWayCompare {
+    template <typename A, typename B>
+    int operator()(const A& a, const B& b) const
+    {
+        if constexpr (is_convertible<const A&, string_view>::value && is_convertible<const B&, string_view>::value)
+            return string_view(a).compare(string_view(b));
+        else
+            return (b < a) - (a < b);
+    }
+};
+
+// Compare is a stateless three-way comparator, see ThreeWayCompare.
+template <typename Key, typename Info, template <typename> class Allocator = NodePool, typename Stats = NoStats, typename Compare = ThreeWayCompare>
+class Dictionary : private Stats {
 public:
     class Node {
     public:
-        Node(Key key, Info info);
+        // the key is built from key, the info from the remaining arguments
+        template <typename K, typename... Args>
+        explicit Node(K&& key, Args&&... args)
+            : key_(forward<K>(key))
+            , info_(forward<Args>(args)...)
+            , child_ { nullptr, nullptr }
+            , size_(1)
+            , balance_(1)
+        {
+        }
 
-        Key getKey() const
+        const Key& getKey() const
         {
             return key_;
         }
 
         void setKey(Key key)
         {
-            key_ = key;
+            key_ = move(key);
+        }
+
+        Info& getInfo()
+        {
+            return info_;
         }
 
-        Info getInfo() const
+        const Info& getInfo() const
         {
             return info_;
         }
 
         void setInfo(Info info)
         {
-            info_ = info;
+            info_ = move(info);
+        }
+
+        // the left child if right is false, so a search picks a side from the sign of one comparison
+        Node* getChild(bool right) const
+        {
+            return child_[right];
         }
 
         Node* getLeft() const
         {
-            return left_;
+            return child_[0];
         }
 
         void setLeft(Node* left)
         {
-            left_ = left;
+            child_[0] = left;
         }
 
         Node* getRight() const
         {
-            return right_;
+            return child_[1];
         }
 
         void setRight(Node* right)
         {
-            right_ = right;
+            child_[1] = right;
         }
 
-        int getHeight() const
+        // height of the left subtree minus height of the right one: -1, 0 or 1
+        int getBalance() const
         {
-            return height_;
+            return static_cast<int>(balance_) - 1;
         }
 
-        void setHeight(int height)
+        void setBalance(int balance)
         {
-            height_ = height;
+            balance_ = static_cast<uint64_t>(balance + 1);
+        }
+
+        size_t getSize() const
+        {
+            return size_;
+        }
+
+        void setSize(size_t size)
+        {
+            size_ = size;
         }
 
     private:
         Key key_;
         Info info_;
-        Node* left_;
-        Node* right_;
-        int height_;
+        Node* child_[2]; // left, right
+        uint64_t size_ : 62; // number of nodes in the subtree
+        uint64_t balance_ : 2; // balance factor + 1
+    };
+
+    // an AVL tree of height 64 holds more than 10^13 nodes
+    static constexpr int kMaxHeight = 64;
+
+    // Bidirectional in-order iterator. It keeps the path from the root to the
+    // current node in a fixed array, so stepping neither recurses nor allocates
+    // and costs amortized O(1). Like Ring, the end is circular: ++end() is
+    // begin() and --begin() is end().
+    class const_iterator {
+    public:
+        using iterator_category = bidirectional_iterator_tag;
+        using value_type = Node;
+        using difference_type = ptrdiff_t;
+        using pointer = const Node*;
+        using reference = const Node&;
+
+        const_iterator() = default;
+
+        const Node& operator*() const
+        {
+            return *path_[depth_ - 1];
+        }
+
+        const Node* operator->() const
+        {
+            return path_[depth_ - 1];
+        }
+
+        const_iterator& operator++();
+
+        const_iterator operator++(int)
+        {
+            const_iterator before = *this;
+            ++*this;
+            return before;
+        }
+
+        const_iterator& operator--();
+
+        const_iterator operator--(int)
+        {
+            const_iterator before = *this;
+            --*this;
+            return before;
+        }
+
+        bool operator==(const const_iterator& it) const
+        {
+            return _current() == it._current();
+        }
+
+        bool operator!=(const const_iterator& it) const
+        {
+            return _current() != it._current();
+        }
+
+    private:
+        friend class Dictionary;
+
+        const Node* root_ = nullptr;
+        const Node* path_[kMaxHeight];
+        int depth_ = 0; // 0 means end()
+
+        explicit const_iterator(const Node* root)
+            : root_(root)
+        {
+        }
+
+        const Node* _current() const
+        {
+            return depth_ ? path_[depth_ - 1] : nullptr;
+        }
+
+        void _pushLeftmost(const Node* node);
+
+        void _pushRightmost(const Node* node);
     };
 
+    // entries can't be modified in place without breaking the key order
+    using iterator = const_iterator;
+
 private:
+    using NodeAllocator = Allocator<Node>;
+    using NodeTraits = allocator_traits<NodeAllocator>;
+
     Node* root_ = nullptr;
+    NodeAllocator alloc_;
+
+    template <typename... Args>
+    Node* _createNode(Args&&... args);
+
+    void _destroyNode(Node* node);
+
+    void _destroyPayloads(Node* root);
+
+    template <typename K, typename... Args>
+    pair<Info*, bool> _tryEmplace(K&& key, Args&&... args);
+
+    template <typename K, typename Make>
+    Node* _insert(const K& key, Make& make);
+
+    void _relink(Node* parent, bool left, Node* child);
+
+    Node* _removeMin(Node* root, int height, Node*& min, int& new_height);
+
+    Node* _fixLeft(Node* root);
+
+    Node* _fixRight(Node* root);
+
+    Node* _balance(Node* root, int left_height, int right_height, int& height);
+
+    template <typename K>
+    Node* _find(const K& key) const;
+
+    template <typename A, typename B>
+    static int _compare(const A& a, const B& b)
+    {
+        return Compare()(a, b);
+    }
+
+    template <typename A, typename B>
+    static bool _less(const A& a, const B& b)
+    {
+        return Compare()(a, b) < 0;
+    }
+
+    // subproblems of set operations smaller than this are not forked
+    static constexpr size_t kParallelCutoff = 1 << 12;
+
+    void _adopt(Dictionary& other);
+
+    // Tree surgery below passes subtree heights along instead of storing them;
+    // height arguments are inputs, the trailing int& receives the result's height.
+    Node* _join(Node* left, int left_height, Node* middle, Node* right, int right_height, int& height);
+
+    Node* _joinLeft(Node* left, int left_height, Node* middle, Node* right, int right_height, int& height);
+
+    Node* _joinRight(Node* left, int left_height, Node* middle, Node* right, int right_height, int& height);
+
+    Node* _join2(Node* left, int left_height, Node* right, int right_height, int& height);
+
+    Node* _split(Node* root, int height, const Key& key, Node*& left, int& left_height, Node*& right, int& right_height);
+
+    Node* _union(Node* a, int a_height, Node* b, int b_height, int& height, vector<Node*>& garbage);
+
+    Node* _intersection(Node* a, int a_height, Node* b, int b_height, int& height, vector<Node*>& garbage);
 
-    Node* _insert(Node* root, Key key, Info info);
+    Node* _difference(Node* a, int a_height, Node* b, int b_height, int& height, vector<Node*>& garbage);
 
-    Node* _remove(Node* root, Key key);
+    template <typename Left, typename Right>
+    void _fork(size_t work, vector<Node*>& garbage, Left left, Right right);
+
+    void _collectGarbage(vector<Node*>& garbage);
+
+    Node* _rotateRight(Node* root);
+
+    Node* _rotateLeft(Node* root);
+
+    static int _computeHeight(const Node* root);
+
+    static int _leftHeight(const Node* root, int height);
+
+    static int _rightHeight(const Node* root, int height);
+
+    static int _bitWidth(size_t n);
+
+    static size_t _getSize(const Node* root);
+
+    void _update(Node* root);
+
+    template <typename ForwardIt>
+    Node* _buildBalanced(ForwardIt& it, ForwardIt last, size_t n);
+
+    Node* _insertBatch(Node* root, int height, pair<Key, Info>* first, pair<Key, Info>* last, BatchPolicy policy, int& new_height, size_t& inserted);
+
+    Node* _eraseBatch(Node* root, int height, const Key* first, const Key* last, int& new_height, size_t& removed);
+
+    void _printInOrder(Node* root) const;
+
+    void _printPreOrder(Node* root) const;
+
+    void _printPostOrder(Node* root) const;
+
+    void _printLevels(Node* root, int height);
+
+    void _display(Dictionary::Node* root);
+
+    void _countDepths(const Node* root, size_t depth, vector<size_t>& histogram) const;
+
+public:
+    Dictionary();
+
+    // Builds a perfectly balanced tree in O(n) from (key, info) pairs. The range
+    // must be ordered by key unless sorted is false, in which case it is sorted
+    // first. For repeated keys the first entry wins, as with insert().
+    template <typename InputIt>
+    Dictionary(InputIt first, InputIt last, bool sorted = true);
+
+    Dictionary(const Dictionary&) = delete;
+
+    Dictionary& operator=(const Dictionary&) = delete;
+
+    ~Dictionary();
+
+    void destroy(Node* root);
+
+    void clear();
+
+    template <typename InputIt>
+    void assign(InputIt first, InputIt last, bool sorted = true);
+
+    void insert(const Key& key, const Info& info);
+
+    void insert(Key&& key, Info&& info);
+
+    // Builds a node from args (the key first, then the info) and links it in
+    // unless the key is present. Returns the info stored under the key and
+    // whether the node was inserted.
+    template <typename... Args>
+    pair<Info*, bool> emplace(Args&&... args);
+
+    // Like emplace(), but the info is built from args only if the key is missing.
+    template <typename... Args>
+    pair<Info*, bool> try_emplace(const Key& key, Args&&... args);
+
+    template <typename... Args>
+    pair<Info*, bool> try_emplace(Key&& key, Args&&... args);
+
+    // Lookups accept any type that Compare can compare with Key, e.g. a
+    // string_view against string keys, so no temporary Key is built.
+    template <typename K>
+    void remove(const K& key);
+
+    // Insert or remove a batch of (key, info) pairs or keys at once: the batch
+    // is sorted and split around every node on a single descent, then the
+    // pieces are joined back bottom-up, so upper levels are visited once per
+    // batch instead of once per key. Return how many keys were added or removed.
+    template <typename InputIt>
+    size_t insertBatch(InputIt first, InputIt last, BatchPolicy policy = BatchPolicy::kFirstWins);
+
+    template <typename InputIt>
+    size_t eraseBatch(InputIt first, InputIt last);
+
+    // nullptr if the key is missing
+    template <typename K>
+    Info* find(const K& key);
+
+    template <typename K>
+    const Info* find(const K& key) const;
+
+    size_t size() const;
+
+    // k-th smallest entry (counting from 0), nullptr if k >= size()
+    const Node* select(size_t k) const;
+
+    // number of keys smaller than key
+    size_t rank(const Key& key) const;
+
+    // number of keys in [lo, hi)
+    size_t countRange(const Key& lo, const Key& hi) const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    // first entry whose key is not less than key
+    const_iterator lower_bound(const Key& key) const;
+
+    // first entry whose key is greater than key
+    const_iterator upper_bound(const Key& key) const;
+
+    pair<const_iterator, const_iterator> equal_range(const Key& key) const;
+
+    // calls fn(key, info) for every entry with a key in [lo, hi), in key order
+    template <typename Function>
+    void forEachInRange(const Key& lo, const Key& hi, Function fn) const;
+
+    FrozenDictionary<Key, Info> freeze() const;
+
+    // The stats policy, e.g. to reset() a DictionaryStats.
+    Stats& stats()
+    {
+        return *this;
+    }
+
+    // Counters of the stats policy plus the shape of the tree, which takes a
+    // walk over every node.
+    DictionaryStatsSnapshot statsSnapshot() const;
+
+    // Writes the entries in the format MappedDictionary::open() maps. The file
+    // is written next to path and renamed over it, so readers never see a
+    // partial file. Returns false if it couldn't be written.
+    bool save(const string& path) const;
+
+    // Writes the entries in key order through a BufferedWriter. Returns false
+    // if the sink failed.
+    bool exportTo(Sink& sink, ExportFormat format = ExportFormat::kText) const;
+
+    // Appends right, whose keys must all be greater than ours, in O(log n).
+    // right ends up empty.
+    void join(Dictionary& right);
+
+    // Moves the entries with keys not less than key into right, replacing its
+    // contents, in O(log n).
+    void split(const Key& key, Dictionary& right);
+
+    // Join-based set operations taking O(m log(n/m + 1)) work for sizes m <= n.
+    // Large inputs are processed in parallel on ForkJoinPool::shared(). They
+    // consume other, which ends up empty; on equal keys our info is kept.
+    void unionWith(Dictionary& other);
+
+    void intersectionWith(Dictionary& other);
+
+    void differenceWith(Dictionary& other);
+
+    void printInOrder() const;
+
+    void printPreOrder() const;
+
+    void printPostOrder() const;
+
+    void display();
+};
+
+// Dictionary for small sizes. Up to kFlatLimit entries are kept sorted in
+// arrays inside the object, keys apart from infos, so a lookup scans one or
+// two cache lines and needs no allocation. Growing past the limit moves the
+// entries into a Dictionary, which is only allocated then; it only moves back
+// once the tree shrinks to half the limit, so a size hovering around the limit
+// doesn't convert every time. Both forms order keys by Compare, a three-way
+// comparator as in Dictionary.
+template <typename Key, typename Info, size_t kFlatLimit = 32, typename Compare = ThreeWayCompare>
+class CompactDictionary {
+    static_assert(kFlatLimit > 1, "the flat array must hold at least two entries");
+
+public:
+    CompactDictionary() = default;
+
+    CompactDictionary(const CompactDictionary&) = delete;
+
+    CompactDictionary& operator=(const CompactDictionary&) = delete;
+
+    ~CompactDictionary();
+
+    void insert(const Key& key, const Info& info);
+
+    void insert(Key&& key, Info&& info);
+
+    template <typename K>
+    void remove(const K& key);
+
+    // nullptr if the key is missing
+    template <typename K>
+    Info* find(const K& key);
+
+    template <typename K>
+    const Info* find(const K& key) const;
+
+    size_t size() const;
+
+    // true while the entries are in the flat arrays
+    bool isFlat() const
+    {
+        return !tree_;
+    }
+
+    // calls fn(key, info) for every entry with a key in [lo, hi), in key order
+    template <typename Function>
+    void forEachInRange(const Key& lo, const Key& hi, Function fn) const;
+
+private:
+    using Tree = Dictionary<Key, Info, NodePool, NoStats, Compare>;
+
+    static constexpr size_t kShrinkLimit = kFlatLimit / 2;
+
+    alignas(Key) unsigned char keys_[kFlatLimit * sizeof(Key)];
+    alignas(Info) unsigned char infos_[kFlatLimit * sizeof(Info)];
+    size_t count_ = 0;
+    unique_ptr<Tree> tree_; // null while the entries are flat
+
+    Key* _keys() const
+    {
+        return reinterpret_cast<Key*>(const_cast<unsigned char*>(keys_));
+    }
+
+    Info* _infos() const
+    {
+        return reinterpret_cast<Info*>(const_cast<unsigned char*>(infos_));
+    }
+
+    template <typename A, typename B>
+    static bool _less(const A& a, const B& b)
+    {
+        return Compare()(a, b) < 0;
+    }
+
+    template <typename K, typename I>
+    void _insert(K&& key, I&& info);
+
+    template <typename K>
+    size_t _lowerBound(const K& key) const;
+
+    void _toTree();
+
+    void _toFlat();
+
+    void _destroyFlat();
+};
+
+// Dictionary for many concurrent readers and one writer at a time. Published
+// nodes are never modified: insert() and remove() copy the root-to-leaf path
+// (and the nodes rotations touch) and publish the new root with one atomic
+// store. Readers pin an epoch, load the root and search without locks;
+// replaced nodes are freed once no reader can still be inside an older epoch.
+// Compare is a stateless three-way comparator, as in Dictionary.
+template <typename Key, typename Info, typename Compare = ThreeWayCompare>
+class ConcurrentDictionary {
+public:
+    class Node {
+    public:
+        template <typename K, typename I>
+        Node(K&& key, I&& info, uint64_t version);
+
+        const Key& getKey() const
+        {
+            return key_;
+        }
+
+        void setKey(Key key)
+        {
+            key_ = move(key);
+        }
+
+        const Info& getInfo() const
+        {
+            return info_;
+        }
+
+        void setInfo(Info info)
+        {
+            info_ = move(info);
+        }
+
+        Node* getLeft() const
+        {
+            return left_;
+        }
+
+        void setLeft(Node* left)
+        {
+            left_ = left;
+        }
+
+        Node* getRight() const
+        {
+            return right_;
+        }
+
+        void setRight(Node* right)
+        {
+            right_ = right;
+        }
+
+        int getHeight() const
+        {
+            return height_;
+        }
+
+        void setHeight(int height)
+        {
+            height_ = height;
+        }
+
+        uint64_t getVersion() const
+        {
+            return version_;
+        }
+
+        void setVersion(uint64_t version)
+        {
+            version_ = version;
+        }
+
+    private:
+        Key key_;
+        Info info_;
+        Node* left_;
+        Node* right_;
+        int height_;
+        uint64_t version_; // write that created the node
+    };
+
+private:
+    struct alignas(64) ReaderSlot {
+        atomic<uint64_t> epoch { 0 }; // 0 while the thread is outside any ReadGuard
+        size_t depth = 0; // nesting of guards, touched only by the owning thread
+    };
+
+public:
+    // Snapshot of the tree for the calling thread. Every node reachable from
+    // root() stays valid until the guard is destroyed.
+    class ReadGuard {
+    public:
+        explicit ReadGuard(const ConcurrentDictionary& dictionary);
+
+        ReadGuard(const ReadGuard&) = delete;
+
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        ~ReadGuard();
+
+        const Node* root() const
+        {
+            return root_;
+        }
+
+    private:
+        ReaderSlot& slot_;
+        mutex* overflow_; // set when the slot is shared with other threads
+        const Node* root_;
+    };
+
+    ConcurrentDictionary() = default;
+
+    ConcurrentDictionary(const ConcurrentDictionary&) = delete;
+
+    ConcurrentDictionary& operator=(const ConcurrentDictionary&) = delete;
+
+    ~ConcurrentDictionary();
+
+    void insert(const Key& key, const Info& info);
+
+    void insert(Key&& key, Info&& info);
+
+    void remove(const Key& key);
+
+    bool find(const Key& key, Info& info) const;
+
+private:
+    struct Retired {
+        uint64_t epoch;
+        vector<Node*> nodes;
+    };
+
+    // threads past the first kMaxReaders share one extra slot under overflow_
+    static constexpr size_t kMaxReaders = 128;
+
+    atomic<Node*> root_ { nullptr };
+    atomic<uint64_t> epoch_ { 1 };
+    mutable ReaderSlot readers_[kMaxReaders + 1];
+    mutable mutex overflow_;
+    mutex writer_;
+    uint64_t version_ = 0; // bumped by every write; nodes stamped with it are not published yet
+    vector<Node*> unlinked_; // nodes replaced by the write in progress
+    deque<Retired> retired_;
+
+    static size_t _readerIndex();
+
+    static int _compare(const Key& a, const Key& b)
+    {
+        return Compare()(a, b);
+    }
+
+    template <typename K, typename I>
+    Node* _insert(Node* root, K&& key, I&& info);
+
+    Node* _remove(Node* root, const Key& key);
+
+    Node* _rebalance(Node* root);
+
+    Node* _rotateRight(Node* root);
+
+    Node* _rotateLeft(Node* root);
+
+    Node* _mutable(Node* node);
+
+    void _unlink(Node* node);
+
+    void _publish(Node* root);
+
+    int _getHeight(const Node* root) const;
+
+    void _destroy(Node* root);
+};
+
+// Counters of one ShardedDictionary shard, read with relaxed loads.
+struct ShardStats {
+    size_t size;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t contended; // lock acquisitions that had to wait
+};
+
+// Dictionary split into N independently locked shards, so writers on different
+// shards never wait for each other. Keys are spread by hash, or by ranges when
+// the constructor is given N - 1 increasing split keys: shard i then holds the
+// keys in [splits[i - 1], splits[i]). Every shard is a Dictionary with its own
+// arena behind a reader-writer lock.
+template <typename Key, typename Info, size_t N>
+class ShardedDictionary {
+    static_assert(N > 0, "a ShardedDictionary needs at least one shard");
+
+public:
+    ShardedDictionary() = default;
+
+    explicit ShardedDictionary(const array<Key, N - 1>& splits);
+
+    ShardedDictionary(const ShardedDictionary&) = delete;
+
+    ShardedDictionary& operator=(const ShardedDictionary&) = delete;
+
+    // Returns whether the key was added; an existing key keeps its info, as
+    // with Dictionary::insert().
+    bool insert(const Key& key, const Info& info);
+
+    // Returns whether the key was present.
+    bool remove(const Key& key);
+
+    // Copies the info out, the shard may change as soon as its lock is released.
+    bool find(const Key& key, Info& info) const;
+
+    size_t size() const;
+
+    // Calls fn(key, info) for every entry in key order. All shards are held
+    // for reading meanwhile, so fn sees one consistent state and must not
+    // write to this dictionary.
+    template <typename Function>
+    void forEach(Function fn) const;
+
+    array<ShardStats, N> stats() const;
+
+private:
+    struct alignas(64) Shard {
+        mutable shared_mutex lock;
+        Dictionary<Key, Info> dictionary;
+        mutable atomic<uint64_t> reads { 0 };
+        atomic<uint64_t> writes { 0 };
+        mutable atomic<uint64_t> contended { 0 };
+    };
+
+    Shard shards_[N];
+    array<Key, N - 1> splits_ {};
+    bool ranged_ = false;
+
+    size_t _shardOf(const Key& key) const;
+
+    unique_lock<shared_mutex> _lockForWriting(Shard& shard);
+
+    shared_lock<shared_mutex> _lockForReading(const Shard& shard) const;
+};
+
+// the benchmarks include this file with AVL_TREE_NO_MAIN defined
+#ifndef AVL_TREE_NO_MAIN
+int main()
+{
+    Dictionary<string, int> dictionary;
+    dictionary.insert("aa", 1);
+    dictionary.insert("dd", 2);
+    dictionary.insert("bb", 3);
+    dictionary.insert("ee", 4);
+    dictionary.insert("cc", 5);
+    dictionary.remove("cc");
+    dictionary.printInOrder();
+    dictionary.printPostOrder();
+    dictionary.printPreOrder();
+    dictionary.display();
+
+    cout << "Info of key: aa: ";
+    cout << *dictionary.find("aa") << endl;
+    cout << "Info of key: ee: ";
+    cout << *dictionary.find("ee") << endl;
+
+    Dictionary<int, int> numbers;
+    numbers.insert(1, 10);
+    numbers.remove(1);
+    numbers.insert(2, 10);
+    numbers.insert(3, 10);
+    numbers.insert(4, 10);
+    numbers.insert(5, 10);
+    numbers.insert(6, 10);
+    numbers.insert(7, 10);
+    numbers.insert(8, 10);
+    numbers.insert(9, 10);
+    numbers.printInOrder();
+    numbers.printPostOrder();
+    numbers.printPreOrder();
+    numbers.display();
+
+    cout << "Info of key 6: ";
+    cout << *numbers.find(6) << endl;
+    cout << "Info of non-existing key: ";
+    const int* missing = numbers.find(100);
+    cout << (missing ? to_string(*missing) : "not found") << endl;
+
+    Dictionary<string, int> test;
+    test.insert("word1", 0);
+    test.insert("word1", 0);
+    test.insert("word2", 0); // node with the same key is not inserted the second time
+    test.printInOrder();
+    test.remove("word1");
+    test.remove("word2");
+    test.printInOrder();
+    test.display();
+
+    Dictionary<int, int> low, high;
+    for (int i = 0; i < 6; i++) {
+        low.insert(i, 0);
+        high.insert(i + 3, 1);
+    }
+    low.unionWith(high); // keys 3..5 keep info 0
+    low.printInOrder();
+    low.display();
+
+    vector<pair<int, int>> batch = { { 9, 2 }, { 1, 2 }, { 9, 3 }, { 7, 2 } };
+    size_t added = low.insertBatch(batch.begin(), batch.end(), BatchPolicy::kLastWins); // 1 and 7 take info 2, 9 takes 3
+    vector<int> gone = { 0, 2, 4, 100 };
+    size_t removed = low.eraseBatch(gone.begin(), gone.end());
+    cout << "Batch added " << added << ", removed " << removed << endl;
+    low.printInOrder();
+
+    if (low.save("low.avl")) {
+        MappedDictionary<int, int> mapped = MappedDictionary<int, int>::open("low.avl");
+        int info;
+        if (mapped.find(9, info))
+            cout << "Mapped info of key 9: " << info << endl;
+        remove("low.avl");
+    }
+    cout << "Exporting low as csv:" << endl;
+    OstreamSink out(cout);
+    low.exportTo(out, ExportFormat::kCsv);
+
+    ShardedDictionary<int, int, 2> sharded({ 50 }); // keys below 50 go to shard 0
+    for (int i = 0; i < 100; i += 10)
+        sharded.insert(i, i * i);
+    sharded.forEach([](int key, int info) { cout << key << ":" << info << " "; });
+    cout << endl;
+    for (const ShardStats& shard : sharded.stats())
+        cout << "Shard size " << shard.size << ", writes " << shard.writes << endl;
+
+    CompactDictionary<int, int, 4> compact;
+    for (int i = 0; i < 6; i++)
+        compact.insert(i, i);
+    cout << "Compact size " << compact.size() << (compact.isFlat() ? ", flat" : ", tree") << endl;
+    for (int i = 0; i < 4; i++)
+        compact.remove(i);
+    cout << "Compact size " << compact.size() << (compact.isFlat() ? ", flat" : ", tree") << endl;
+}
+#endif // AVL_TREE_NO_MAIN
+
+void DictionaryStats::fill(DictionaryStatsSnapshot& snapshot) const
+{
+    snapshot.single_rotations = single_rotations_.load(memory_order_relaxed);
+    snapshot.double_rotations = double_rotations_.load(memory_order_relaxed);
+    for (int op = 0; op < 3; op++) {
+        snapshot.operations[op] = operations_[op].load(memory_order_relaxed);
+        snapshot.comparisons[op] = comparisons_[op].load(memory_order_relaxed);
+    }
+    snapshot.allocations = allocations_.load(memory_order_relaxed);
+    snapshot.deallocations = deallocations_.load(memory_order_relaxed);
+}
+
+void DictionaryStats::reset()
+{
+    single_rotations_.store(0, memory_order_relaxed);
+    double_rotations_.store(0, memory_order_relaxed);
+    for (int op = 0; op < 3; op++) {
+        operations_[op].store(0, memory_order_relaxed);
+        comparisons_[op].store(0, memory_order_relaxed);
+    }
+    allocations_.store(0, memory_order_relaxed);
+    deallocations_.store(0, memory_order_relaxed);
+}
+
+ForkJoinPool::ForkJoinPool(size_t workers)
+    : queues_(new Queue[workers + 1])
+    , queue_count_(workers + 1)
+{
+    for (size_t i = 0; i < workers; i++)
+        threads_.emplace_back(&ForkJoinPool::_work, this, i);
+}
+
+ForkJoinPool::~ForkJoinPool()
+{
+    stop_.store(true);
+    idle_.notify_all();
+    for (thread& worker : threads_)
+        worker.join();
+}
+
+ForkJoinPool& ForkJoinPool::shared()
+{
+    static ForkJoinPool pool;
+    return pool;
+}
+
+thread_local ForkJoinPool* ForkJoinPool::current_pool_ = nullptr;
+thread_local size_t ForkJoinPool::current_queue_ = 0;
+
+template <typename Left, typename Right>
+void ForkJoinPool::invoke(Left&& left, Right&& right)
+{
+    using Function = remove_reference_t<Right>;
+    Task task;
+    task.call = [](void* function) { (*static_cast<Function*>(function))(); };
+    task.function = const_cast<void*>(static_cast<const void*>(&right));
+
+    size_t queue = _queueIndex();
+    {
+        lock_guard<mutex> guard(queues_[queue].lock);
+        queues_[queue].tasks.push_back(&task);
+    }
+    idle_.notify_one();
+
+    left();
+    // forks made by left() are joined by now, so the task is still at the back unless it was stolen
+    if (_popBack(queue, &task)) {
+        _run(&task);
+        return;
+    }
+    while (!task.done.load()) {
+        if (Task* other = _steal(queue))
+            _run(other);
+        else
+            this_thread::yield();
+    }
+}
+
+size_t ForkJoinPool::_queueIndex() const
+{
+    return current_pool_ == this ? current_queue_ : queue_count_ - 1;
+}
+
+bool ForkJoinPool::_popBack(size_t queue, Task* task)
+{
+    lock_guard<mutex> guard(queues_[queue].lock);
+    deque<Task*>& tasks = queues_[queue].tasks;
+    if (tasks.empty() || tasks.back() != task)
+        return false;
+    tasks.pop_back();
+    return true;
+}
+
+ForkJoinPool::Task* ForkJoinPool::_steal(size_t thief)
+{
+    for (size_t i = 1; i <= queue_count_; i++) {
+        Queue& victim = queues_[(thief + i) % queue_count_];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            Task* task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void ForkJoinPool::_run(Task* task)
+{
+    task->call(task->function);
+    task->done.store(true);
+}
+
+void ForkJoinPool::_work(size_t queue)
+{
+    current_pool_ = this;
+    current_queue_ = queue;
+    while (!stop_.load()) {
+        if (Task* task = _steal(queue)) {
+            _run(task);
+        } else {
+            unique_lock<mutex> lock(idle_lock_);
+            idle_.wait_for(lock, chrono::milliseconds(1));
+        }
+    }
+}
+
+template <typename T>
+typename NodePool<T>::Arena& NodePool<T>::_arena()
+{
+    if (!arena_)
+        arena_ = make_shared<Arena>();
+    while (arena_->forward)
+        arena_ = arena_->forward;
+    return *arena_;
+}
+
+template <typename T>
+T* NodePool<T>::allocate(size_t n)
+{
+    if (n != 1)
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    Arena& arena = _arena();
+    if (arena.free) {
+        Block* block = arena.free;
+        arena.free = block->next;
+        return reinterpret_cast<T*>(block->storage);
+    }
+    if (!arena.current || arena.used == kBlocksPerSlab) {
+        if (arena.current && arena.current->next) {
+            arena.current = arena.current->next; // slab kept by a previous reset()
+        } else {
+            Slab* slab = new Slab;
+            slab->next = nullptr;
+            if (arena.current)
+                arena.current->next = slab;
+            else
+                arena.slabs = slab;
+            arena.current = slab;
+        }
+        arena.used = 0;
+    }
+    return reinterpret_cast<T*>(arena.current->blocks[arena.used++].storage);
+}
+
+template <typename T>
+void NodePool<T>::deallocate(T* p, size_t n)
+{
+    if (n != 1) {
+        ::operator delete(p);
+        return;
+    }
+    Arena& arena = _arena();
+    Block* block = reinterpret_cast<Block*>(p);
+    block->next = arena.free;
+    arena.free = block;
+}
+
+template <typename T>
+bool NodePool<T>::exclusive()
+{
+    _arena();
+    return arena_.use_count() == 1;
+}
+
+template <typename T>
+void NodePool<T>::reset()
+{
+    Arena& arena = _arena();
+    arena.current = arena.slabs;
+    arena.used = 0;
+    arena.free = nullptr;
+}
+
+template <typename T>
+void NodePool<T>::release()
+{
+    arena_.reset(); // the slabs go away with the last pool using them
+}
+
+template <typename T>
+void NodePool<T>::merge(NodePool& other)
+{
+    Arena& mine = _arena();
+    Arena& theirs = other._arena();
+    if (&mine == &theirs)
+        return;
+    // their slabs go in front of ours, where the bump pointer never returns to before a reset
+    if (theirs.slabs) {
+        Slab* last = theirs.slabs;
+        while (last->next)
+            last = last->next;
+        last->next = mine.slabs;
+        mine.slabs = theirs.slabs;
+        if (!mine.current) {
+            mine.current = last;
+            mine.used = kBlocksPerSlab;
+        }
+    }
+    if (theirs.free) {
+        Block* last = theirs.free;
+        while (last->next)
+            last = last->next;
+        last->next = mine.free;
+        mine.free = theirs.free;
+    }
+    theirs.slabs = theirs.current = nullptr;
+    theirs.free = nullptr;
+    // pools still pointing at their arena find ours on their next access
+    theirs.forward = arena_;
+    other.arena_ = arena_;
+}
+
+template <typename T>
+NodePool<T>::Arena::~Arena()
+{
+    while (slabs) {
+        Slab* next = slabs->next;
+        delete slabs;
+        slabs = next;
+    }
+}
+
+template <typename T>
+T* SharedNodePool<T>::allocate(size_t n)
+{
+    if (n != 1)
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    Cache& cache = cache_;
+    if (!cache.free)
+        _refill(cache);
+    Block* block = cache.free;
+    cache.free = block->next;
+    cache.count--;
+    return reinterpret_cast<T*>(block->storage);
+}
+
+template <typename T>
+void SharedNodePool<T>::deallocate(T* p, size_t n)
+{
+    if (n != 1) {
+        ::operator delete(p);
+        return;
+    }
+    Cache& cache = cache_;
+    Block* block = reinterpret_cast<Block*>(p);
+    block->next = cache.free;
+    cache.free = block;
+    if (++cache.count > 2 * kBatch)
+        _flush(cache, kBatch);
+}
+
+template <typename T>
+typename SharedNodePool<T>::Central& SharedNodePool<T>::_central()
+{
+    static Central central;
+    return central;
+}
+
+template <typename T>
+void SharedNodePool<T>::_refill(Cache& cache)
+{
+    Central& central = _central();
+    lock_guard<mutex> guard(central.lock);
+    if (!central.free) {
+        Block* slab = new Block[kBatch * 16];
+        central.slabs.push_back(slab);
+        for (size_t i = 0; i < kBatch * 16; i++) {
+            slab[i].next = central.free;
+            central.free = &slab[i];
+        }
+    }
+    while (central.free && cache.count < kBatch) {
+        Block* block = central.free;
+        central.free = block->next;
+        block->next = cache.free;
+        cache.free = block;
+        cache.count++;
+    }
+}
+
+template <typename T>
+void SharedNodePool<T>::_flush(Cache& cache, size_t count)
+{
+    Central& central = _central();
+    lock_guard<mutex> guard(central.lock);
+    while (cache.free && count--) {
+        Block* block = cache.free;
+        cache.free = block->next;
+        block->next = central.free;
+        central.free = block;
+        cache.count--;
+    }
+}
+
+template <typename T>
+SharedNodePool<T>::Cache::~Cache()
+{
+    _flush(*this, count);
+}
+
+template <typename T>
+SharedNodePool<T>::Central::~Central()
+{
+    for (Block* slab : slabs)
+        delete[] slab;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+Dictionary<Key, Info, Allocator, Stats, Compare>::Dictionary()
+{
+    root_ = nullptr;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+Dictionary<Key, Info, Allocator, Stats, Compare>::~Dictionary()
+{
+    destroy(root_);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::destroy(Dictionary::Node* root)
+{
+    if constexpr (is_arena<NodeAllocator>::value) {
+        if (root && root == root_ && alloc_.exclusive()) {
+            // the whole tree lives in our arena: run destructors if there are any, then recycle every slab at once
+            Stats::countDeallocations(root->getSize());
+            _destroyPayloads(root);
+            alloc_.reset();
+            root_ = nullptr;
+            return;
+        }
+    }
+    if (root) {
+        destroy(root->getLeft());
+        destroy(root->getRight());
+        _destroyNode(root);
+        if (root == root_)
+            root_ = nullptr;
+    }
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::clear()
+{
+    destroy(root_);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_destroyPayloads(Dictionary::Node* root)
+{
+    if (is_trivially_destructible<Node>::value || !root)
+        return;
+    _destroyPayloads(root->getLeft());
+    _destroyPayloads(root->getRight());
+    NodeTraits::destroy(alloc_, root);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename... Args>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_createNode(Args&&... args)
+{
+    Node* node = NodeTraits::allocate(alloc_, 1);
+    NodeTraits::construct(alloc_, node, forward<Args>(args)...);
+    Stats::countAllocations(1);
+    return node;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_destroyNode(Dictionary::Node* node)
+{
+    NodeTraits::destroy(alloc_, node);
+    NodeTraits::deallocate(alloc_, node, 1);
+    Stats::countDeallocations(1);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename InputIt>
+Dictionary<Key, Info, Allocator, Stats, Compare>::Dictionary(InputIt first, InputIt last, bool sorted)
+{
+    assign(first, last, sorted);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename InputIt>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::assign(InputIt first, InputIt last, bool sorted)
+{
+    using Category = typename iterator_traits<InputIt>::iterator_category;
+    if (!sorted || !is_base_of<forward_iterator_tag, Category>::value) {
+        // single-pass input can't be counted up front, unsorted input has to be ordered first
+        vector<pair<Key, Info>> entries(first, last);
+        if (!sorted)
+            stable_sort(entries.begin(), entries.end(), [](const pair<Key, Info>& a, const pair<Key, Info>& b) { return _less(a.first, b.first); });
+        assign(entries.begin(), entries.end(), true);
+        return;
+    }
+    if constexpr (is_base_of<forward_iterator_tag, Category>::value) {
+        destroy(root_);
+        size_t n = 0;
+        for (InputIt it = first, prev = first; it != last; prev = it++) {
+            if (it == first || _less(prev->first, it->first))
+                n++;
+        }
+        root_ = _buildBalanced(first, last, n);
+    }
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename ForwardIt>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_buildBalanced(ForwardIt& it, ForwardIt last, size_t n)
+{
+    if (n == 0)
+        return nullptr;
+    // nodes are created in key order, so a fresh arena lays them out contiguously
+    Node* left = _buildBalanced(it, last, (n - 1) / 2);
+    Node* root = _createNode((*it).first, (*it).second); // moves from a move_iterator
+    for (++it; it != last && !_less(root->getKey(), (*it).first); ++it) { } // skip repeated keys
+    Node* right = _buildBalanced(it, last, n - 1 - (n - 1) / 2);
+    root->setLeft(left);
+    root->setRight(right);
+    // a subtree built from m nodes is bitWidth(m) high
+    root->setBalance(_bitWidth((n - 1) / 2) - _bitWidth(n - 1 - (n - 1) / 2));
+    _update(root);
+    return root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename InputIt>
+size_t Dictionary<Key, Info, Allocator, Stats, Compare>::insertBatch(InputIt first, InputIt last, BatchPolicy policy)
+{
+    vector<pair<Key, Info>> entries(first, last);
+    stable_sort(entries.begin(), entries.end(), [](const pair<Key, Info>& a, const pair<Key, Info>& b) { return _less(a.first, b.first); });
+    // keep one entry per key, the first or last of its run
+    size_t n = 0;
+    for (size_t i = 0, j; i < entries.size(); i = j) {
+        for (j = i + 1; j < entries.size() && !_less(entries[i].first, entries[j].first); j++) { }
+        size_t kept = policy == BatchPolicy::kFirstWins ? i : j - 1;
+        if (kept != n)
+            entries[n] = move(entries[kept]);
+        n++;
+    }
+    size_t inserted = 0;
+    int height;
+    root_ = _insertBatch(root_, _computeHeight(root_), entries.data(), entries.data() + n, policy, height, inserted);
+    return inserted;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename InputIt>
+size_t Dictionary<Key, Info, Allocator, Stats, Compare>::eraseBatch(InputIt first, InputIt last)
+{
+    vector<Key> keys(first, last);
+    sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) { return _less(a, b); });
+    keys.erase(unique(keys.begin(), keys.end(), [](const Key& a, const Key& b) { return _compare(a, b) == 0; }), keys.end());
+    size_t removed = 0;
+    int height;
+    root_ = _eraseBatch(root_, _computeHeight(root_), keys.data(), keys.data() + keys.size(), height, removed);
+    return removed;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_insertBatch(Node* root, int height, pair<Key, Info>* first, pair<Key, Info>* last, BatchPolicy policy, int& new_height, size_t& inserted)
+{
+    if (first == last) {
+        new_height = height;
+        return root;
+    }
+    if (!root) {
+        // what is left of the batch becomes a whole subtree
+        size_t n = last - first;
+        inserted += n;
+        new_height = _bitWidth(n);
+        auto it = make_move_iterator(first);
+        return _buildBalanced(it, make_move_iterator(last), n);
+    }
+    pair<Key, Info>* middle = std::lower_bound(first, last, root->getKey(), [](const pair<Key, Info>& entry, const Key& key) { return _less(entry.first, key); });
+    pair<Key, Info>* rest = middle;
+    if (middle != last && !_less(root->getKey(), middle->first)) {
+        if (policy == BatchPolicy::kLastWins)
+            root->setInfo(move(middle->second));
+        rest++;
+    }
+    int left_height, right_height;
+    Node* left = _insertBatch(root->getLeft(), _leftHeight(root, height), first, middle, policy, left_height, inserted);
+    Node* right = _insertBatch(root->getRight(), _rightHeight(root, height), rest, last, policy, right_height, inserted);
+    return _join(left, left_height, root, right, right_height, new_height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_eraseBatch(Node* root, int height, const Key* first, const Key* last, int& new_height, size_t& removed)
+{
+    if (!root || first == last) {
+        new_height = height;
+        return root;
+    }
+    const Key* middle = std::lower_bound(first, last, root->getKey(), [](const Key& a, const Key& b) { return _less(a, b); });
+    bool hit = middle != last && !_less(root->getKey(), *middle);
+    int left_height, right_height;
+    Node* left = _eraseBatch(root->getLeft(), _leftHeight(root, height), first, middle, left_height, removed);
+    Node* right = _eraseBatch(root->getRight(), _rightHeight(root, height), hit ? middle + 1 : middle, last, right_height, removed);
+    if (!hit)
+        return _join(left, left_height, root, right, right_height, new_height);
+    _destroyNode(root);
+    removed++;
+    return _join2(left, left_height, right, right_height, new_height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::insert(const Key& key, const Info& info)
+{
+    _tryEmplace(key, info);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::insert(Key&& key, Info&& info)
+{
+    _tryEmplace(move(key), move(info));
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename... Args>
+pair<Info*, bool> Dictionary<Key, Info, Allocator, Stats, Compare>::emplace(Args&&... args)
+{
+    // the key only exists once the node is built
+    Node* node = _createNode(forward<Args>(args)...);
+    bool inserted = false;
+    auto make = [&]() {
+        inserted = true;
+        return node;
+    };
+    Node* found = _insert(node->getKey(), make);
+    if (!inserted)
+        _destroyNode(node);
+    return { &found->getInfo(), inserted };
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename... Args>
+pair<Info*, bool> Dictionary<Key, Info, Allocator, Stats, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return _tryEmplace(key, forward<Args>(args)...);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename... Args>
+pair<Info*, bool> Dictionary<Key, Info, Allocator, Stats, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return _tryEmplace(move(key), forward<Args>(args)...);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename K, typename... Args>
+pair<Info*, bool> Dictionary<Key, Info, Allocator, Stats, Compare>::_tryEmplace(K&& key, Args&&... args)
+{
+    bool inserted = false;
+    auto make = [&]() {
+        inserted = true;
+        return _createNode(forward<K>(key), forward<Args>(args)...);
+    };
+    Node* found = _insert(key, make);
+    return { &found->getInfo(), inserted };
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename K, typename Make>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_insert(const K& key, Make& make)
+{
+    Node* path[kMaxHeight];
+    bool went_left[kMaxHeight];
+    int depth = 0;
+    for (Node* current = root_; current;) {
+        int order = _compare(key, current->getKey());
+        if (order == 0) {
+            Stats::countOperation(DictionaryOp::kInsert, depth + 1);
+            return current;
+        }
+        went_left[depth] = order < 0;
+        path[depth++] = current;
+        current = current->getChild(order > 0);
+    }
+    Stats::countOperation(DictionaryOp::kInsert, depth);
+    // the node is made only once the search ends at an empty slot
+    Node* node = make();
+    _relink(depth ? path[depth - 1] : nullptr, depth && went_left[depth - 1], node);
+    for (int i = 0; i < depth; i++)
+        path[i]->setSize(path[i]->getSize() + 1);
+
+    // retrace while subtrees keep growing; one rotation restores the old height for good
+    while (depth--) {
+        Node* parent = path[depth];
+        int balance = parent->getBalance() + (went_left[depth] ? 1 : -1);
+        if (balance == 0) {
+            parent->setBalance(0);
+            break;
+        }
+        if (balance == 1 || balance == -1) {
+            parent->setBalance(balance);
+            continue;
+        }
+        Node* root = balance > 0 ? _fixLeft(parent) : _fixRight(parent);
+        _relink(depth ? path[depth - 1] : nullptr, depth && went_left[depth - 1], root);
+        break;
+    }
+    return node;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename K>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::remove(const K& key)
+{
+    Node* path[kMaxHeight];
+    bool went_left[kMaxHeight];
+    int depth = 0;
+    Node* target = root_;
+    while (target) {
+        int order = _compare(key, target->getKey());
+        if (order == 0)
+            break;
+        went_left[depth] = order < 0;
+        path[depth++] = target;
+        target = target->getChild(order > 0);
+    }
+    Stats::countOperation(DictionaryOp::kRemove, depth + (target != nullptr));
+    if (!target)
+        return;
+
+    if (!target->getLeft() || !target->getRight()) {
+        Node* child = target->getLeft() ? target->getLeft() : target->getRight();
+        _relink(depth ? path[depth - 1] : nullptr, depth && went_left[depth - 1], child);
+    } else {
+        // the in-order successor is relinked into the target's spot, its key and info stay where they are
+        int target_depth = depth;
+        path[depth] = target;
+        went_left[depth++] = false;
+        Node* successor = target->getRight();
+        while (successor->getLeft()) {
+            path[depth] = successor;
+            went_left[depth++] = true;
+            successor = successor->getLeft();
+        }
+        _relink(path[depth - 1], went_left[depth - 1], successor->getRight());
+        successor->setLeft(target->getLeft());
+        successor->setRight(target->getRight());
+        successor->setBalance(target->getBalance());
+        successor->setSize(target->getSize());
+        _relink(target_depth ? path[target_depth - 1] : nullptr, target_depth && went_left[target_depth - 1], successor);
+        path[target_depth] = successor;
+    }
+    _destroyNode(target);
+    for (int i = 0; i < depth; i++)
+        path[i]->setSize(path[i]->getSize() - 1);
+
+    // retrace while subtrees keep shrinking
+    while (depth--) {
+        Node* parent = path[depth];
+        int balance = parent->getBalance() - (went_left[depth] ? 1 : -1);
+        if (balance == 1 || balance == -1) {
+            parent->setBalance(balance);
+            break;
+        }
+        if (balance == 0) {
+            parent->setBalance(0);
+            continue;
+        }
+        Node* root = balance > 0 ? _fixLeft(parent) : _fixRight(parent);
+        _relink(depth ? path[depth - 1] : nullptr, depth && went_left[depth - 1], root);
+        if (root->getBalance() != 0)
+            break; // the rotation kept the height
+    }
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_relink(Node* parent, bool left, Node* child)
+{
+    if (!parent)
+        root_ = child;
+    else if (left)
+        parent->setLeft(child);
+    else
+        parent->setRight(child);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_removeMin(Node* root, int height, Node*& min, int& new_height)
+{
+    if (!root->getLeft()) {
+        min = root;
+        new_height = height - 1;
+        return root->getRight();
+    }
+    int left_height;
+    int right_height = _rightHeight(root, height);
+    root->setLeft(_removeMin(root->getLeft(), _leftHeight(root, height), min, left_height));
+    return _balance(root, left_height, right_height, new_height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_fixLeft(Node* root)
+{
+    // root's left subtree is two levels taller than its right one; the result
+    // is one level lower than that unless the left child was balanced, which
+    // shows as a new root with a nonzero balance
+    Node* left = root->getLeft();
+    int left_balance = left->getBalance();
+    Stats::countRotation(left_balance < 0);
+    if (left_balance >= 0) {
+        Node* new_root = _rotateRight(root);
+        root->setBalance(left_balance == 0 ? 1 : 0);
+        new_root->setBalance(left_balance == 0 ? -1 : 0);
+        return new_root;
+    }
+    Node* new_root = left->getRight();
+    int pivot_balance = new_root->getBalance();
+    root->setLeft(_rotateLeft(left));
+    _rotateRight(root);
+    left->setBalance(pivot_balance == -1 ? 1 : 0);
+    root->setBalance(pivot_balance == 1 ? -1 : 0);
+    new_root->setBalance(0);
+    return new_root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_fixRight(Node* root)
+{
+    Node* right = root->getRight();
+    int right_balance = right->getBalance();
+    Stats::countRotation(right_balance > 0);
+    if (right_balance <= 0) {
+        Node* new_root = _rotateLeft(root);
+        root->setBalance(right_balance == 0 ? -1 : 0);
+        new_root->setBalance(right_balance == 0 ? 1 : 0);
+        return new_root;
+    }
+    Node* new_root = right->getLeft();
+    int pivot_balance = new_root->getBalance();
+    root->setRight(_rotateRight(right));
+    _rotateLeft(root);
+    right->setBalance(pivot_balance == 1 ? -1 : 0);
+    root->setBalance(pivot_balance == -1 ? 1 : 0);
+    new_root->setBalance(0);
+    return new_root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_balance(Node* root, int left_height, int right_height, int& height)
+{
+    // root just got new children of the given heights, which differ by at most two
+    _update(root);
+    int balance = left_height - right_height;
+    if (balance > 1) {
+        Node* new_root = _fixLeft(root);
+        height = new_root->getBalance() ? left_height + 1 : left_height;
+        return new_root;
+    }
+    if (balance < -1) {
+        Node* new_root = _fixRight(root);
+        height = new_root->getBalance() ? right_height + 1 : right_height;
+        return new_root;
+    }
+    root->setBalance(balance);
+    height = max(left_height, right_height) + 1;
+    return root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename K>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_find(const K& key) const
+{
+    size_t visited = 0;
+    Node* current = root_;
+    for (; current; visited++) {
+        int order = _compare(key, current->getKey());
+        if (order == 0)
+            break;
+        current = current->getChild(order > 0);
+    }
+    Stats::countOperation(DictionaryOp::kFind, visited + (current != nullptr));
+    return current;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename K>
+Info* Dictionary<Key, Info, Allocator, Stats, Compare>::find(const K& key)
+{
+    Node* node = _find(key);
+    return node ? &node->getInfo() : nullptr;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename K>
+const Info* Dictionary<Key, Info, Allocator, Stats, Compare>::find(const K& key) const
+{
+    const Node* node = _find(key);
+    return node ? &node->getInfo() : nullptr;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+FrozenDictionary<Key, Info> Dictionary<Key, Info, Allocator, Stats, Compare>::freeze() const
+{
+    static_assert(is_same<Compare, ThreeWayCompare>::value, "FrozenDictionary searches with operator<");
+    vector<Key> keys;
+    vector<Info> infos;
+    keys.reserve(size());
+    infos.reserve(size());
+    for (const Node& node : *this) {
+        keys.push_back(node.getKey());
+        infos.push_back(node.getInfo());
+    }
+    return FrozenDictionary<Key, Info>(move(keys), move(infos));
+}
+
+template <typename Key, typename Info>
+FrozenDictionary<Key, Info>::FrozenDictionary(vector<Key> keys, vector<Info> infos)
+{
+    keys_.resize(keys.size() + 1);
+    infos_.resize(infos.size() + 1);
+    size_t i = 0;
+    _layout(keys, infos, i, 1);
+}
+
+template <typename Key, typename Info>
+void FrozenDictionary<Key, Info>::_layout(vector<Key>& keys, vector<Info>& infos, size_t& i, size_t k)
+{
+    // an in-order walk of the implicit tree visits the slots in key order
+    if (k < keys_.size()) {
+        _layout(keys, infos, i, 2 * k);
+        keys_[k] = move(keys[i]);
+        infos_[k] = move(infos[i]);
+        i++;
+        _layout(keys, infos, i, 2 * k + 1);
+    }
+}
+
+template <typename Key, typename Info>
+template <typename K>
+size_t FrozenDictionary<Key, Info>::_lowerBound(const K& key) const
+{
+    // keys of 16 consecutive slots on one level share a cache line for int keys,
+    // so prefetching slot k * kLookahead fetches the line needed log2(kLookahead) levels down
+    constexpr size_t kLookahead = 64 / sizeof(Key) > 1 ? 64 / sizeof(Key) : 1;
+    const Key* keys = keys_.data();
+    size_t n = keys_.size();
+    size_t k = 1;
+    while (k < n) {
+        if constexpr (is_trivially_copyable<Key>::value)
+            __builtin_prefetch(keys + k * kLookahead);
+        k = 2 * k + (keys[k] < key);
+    }
+    // the path went right after the last candidate; undo those steps and the final left turn
+    k >>= __builtin_ctzll(~k) + 1;
+    return k;
+}
+
+template <typename Key, typename Info>
+template <typename K>
+bool FrozenDictionary<Key, Info>::contains(const K& key) const
+{
+    size_t k = _lowerBound(key);
+    return k && !(key < keys_[k]);
+}
+
+template <typename Key, typename Info>
+template <typename K>
+const Info* FrozenDictionary<Key, Info>::find(const K& key) const
+{
+    size_t k = _lowerBound(key);
+    if (!k || key < keys_[k])
+        return nullptr;
+    return &infos_[k];
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+DictionaryStatsSnapshot Dictionary<Key, Info, Allocator, Stats, Compare>::statsSnapshot() const
+{
+    DictionaryStatsSnapshot snapshot;
+    Stats::fill(snapshot);
+    snapshot.nodes = size();
+    snapshot.node_bytes = size() * sizeof(Node);
+    _countDepths(root_, 0, snapshot.depth_histogram);
+    return snapshot;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_countDepths(const Node* root, size_t depth, vector<size_t>& histogram) const
+{
+    if (!root)
+        return;
+    if (histogram.size() <= depth)
+        histogram.resize(depth + 1);
+    histogram[depth]++;
+    _countDepths(root->getLeft(), depth + 1, histogram);
+    _countDepths(root->getRight(), depth + 1, histogram);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+bool Dictionary<Key, Info, Allocator, Stats, Compare>::save(const string& path) const
+{
+    static_assert(is_same<Compare, ThreeWayCompare>::value, "MappedDictionary searches with operator<");
+    using KeyCodec = FileCodec<Key>;
+    using InfoCodec = FileCodec<Info>;
+    constexpr size_t kStride = MappedFileHeader::kIndexStride;
+    vector<typename KeyCodec::Stored> keys;
+    vector<typename InfoCodec::Stored> infos;
+    keys.reserve(size());
+    infos.reserve(size());
+    uint64_t heap_size = 0;
+    for (const Node& node : *this) {
+        keys.push_back(KeyCodec::encode(node.getKey(), heap_size));
+        infos.push_back(InfoCodec::encode(node.getInfo(), heap_size));
+    }
+
+    // visit the index slots in order, the same walk FrozenDictionary's layout does
+    size_t index_size = (keys.size() + kStride - 1) / kStride;
+    vector<typename KeyCodec::Stored> index_keys(index_size + 1);
+    vector<uint64_t> index_positions(index_size + 1);
+    size_t k = 1;
+    while (2 * k <= index_size)
+        k *= 2;
+    for (size_t i = 0; i < index_size; i++) {
+        index_keys[k] = keys[i * kStride];
+        index_positions[k] = i * kStride;
+        if (2 * k + 1 <= index_size) {
+            for (k = 2 * k + 1; 2 * k <= index_size; k *= 2) { }
+        } else {
+            k >>= __builtin_ctzll(~k) + 1;
+        }
+    }
+
+    MappedFileHeader header = {};
+    memcpy(header.magic, MappedFileHeader::kMagic, sizeof(header.magic));
+    header.version = MappedFileHeader::kVersion;
+    header.index_stride = kStride;
+    header.key_kind = KeyCodec::kKind;
+    header.key_width = sizeof(typename KeyCodec::Stored);
+    header.info_kind = InfoCodec::kKind;
+    header.info_width = sizeof(typename InfoCodec::Stored);
+    header.size = keys.size();
+    header.index_size = index_size;
+    uint64_t end = sizeof(header);
+    auto place = [&](uint64_t bytes) {
+        uint64_t offset = (end + MappedFileHeader::kAlignment - 1) / MappedFileHeader::kAlignment * MappedFileHeader::kAlignment;
+        end = offset + bytes;
+        return offset;
+    };
+    header.keys_offset = place(keys.size() * sizeof(keys[0]));
+    header.infos_offset = place(infos.size() * sizeof(infos[0]));
+    header.index_keys_offset = place(index_keys.size() * sizeof(index_keys[0]));
+    header.index_positions_offset = place(index_positions.size() * sizeof(index_positions[0]));
+    header.heap_offset = place(heap_size);
+    header.heap_size = heap_size;
+
+    string temporary = path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+    uint64_t written = 0;
+    auto write = [&](uint64_t offset, const void* data, size_t bytes) {
+        static const char kZeros[MappedFileHeader::kAlignment] = {};
+        if (offset > written)
+            fwrite(kZeros, 1, offset - written, file);
+        if (bytes)
+            fwrite(data, 1, bytes, file);
+        written = offset + bytes;
+    };
+    write(0, &header, sizeof(header));
+    write(header.keys_offset, keys.data(), keys.size() * sizeof(keys[0]));
+    write(header.infos_offset, infos.data(), infos.size() * sizeof(infos[0]));
+    write(header.index_keys_offset, index_keys.data(), index_keys.size() * sizeof(index_keys[0]));
+    write(header.index_positions_offset, index_positions.data(), index_positions.size() * sizeof(index_positions[0]));
+    write(header.heap_offset, nullptr, 0);
+    for (const Node& node : *this) {
+        string_view key = KeyCodec::bytes(node.getKey());
+        string_view info = InfoCodec::bytes(node.getInfo());
+        write(written, key.data(), key.size());
+        write(written, info.data(), info.size());
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (ok)
+        ok = rename(temporary.c_str(), path.c_str()) == 0;
+    if (!ok)
+        std::remove(temporary.c_str()); // not our remove()
+    return ok;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+bool Dictionary<Key, Info, Allocator, Stats, Compare>::exportTo(Sink& sink, ExportFormat format) const
+{
+    BufferedWriter writer(sink);
+    for (const Node& node : *this)
+        writer.AppendRecord(node.getKey(), node.getInfo(), format);
+    return writer.Flush();
+}
+
+template <typename Key, typename Info>
+MappedDictionary<Key, Info>::MappedDictionary(MappedDictionary&& other)
+{
+    *this = move(other);
+}
+
+template <typename Key, typename Info>
+MappedDictionary<Key, Info>& MappedDictionary<Key, Info>::operator=(MappedDictionary&& other)
+{
+    if (&other != this) {
+        _unmap();
+        data_ = other.data_;
+        length_ = other.length_;
+        size_ = other.size_;
+        index_size_ = other.index_size_;
+        keys_ = other.keys_;
+        infos_ = other.infos_;
+        index_keys_ = other.index_keys_;
+        index_positions_ = other.index_positions_;
+        heap_ = other.heap_;
+        other.data_ = nullptr;
+        other._unmap();
+    }
+    return *this;
+}
+
+template <typename Key, typename Info>
+MappedDictionary<Key, Info>::~MappedDictionary()
+{
+    _unmap();
+}
+
+template <typename Key, typename Info>
+MappedDictionary<Key, Info> MappedDictionary<Key, Info>::open(const string& path)
+{
+    MappedDictionary dictionary;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return dictionary;
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) < sizeof(MappedFileHeader)) {
+        ::close(fd);
+        return dictionary;
+    }
+    void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+    if (data == MAP_FAILED)
+        return dictionary;
+    dictionary.data_ = data;
+    dictionary.length_ = status.st_size;
+    if (!dictionary._map(*static_cast<const MappedFileHeader*>(data)))
+        dictionary._unmap();
+    return dictionary;
+}
+
+template <typename Key, typename Info>
+bool MappedDictionary<Key, Info>::_map(const MappedFileHeader& header)
+{
+    if (memcmp(header.magic, MappedFileHeader::kMagic, sizeof(header.magic)) != 0 || header.version != MappedFileHeader::kVersion
+        || header.index_stride != MappedFileHeader::kIndexStride || header.key_kind != KeyCodec::kKind
+        || header.key_width != sizeof(typename KeyCodec::Stored) || header.info_kind != InfoCodec::kKind
+        || header.info_width != sizeof(typename InfoCodec::Stored)
+        || header.index_size != (header.size + MappedFileHeader::kIndexStride - 1) / MappedFileHeader::kIndexStride)
+        return false;
+    // sections must be aligned and inside the file; counts are checked by division so nothing overflows
+    auto inside = [&](uint64_t offset, uint64_t count, uint64_t width) {
+        return offset % MappedFileHeader::kAlignment == 0 && offset <= length_ && count <= (length_ - offset) / width;
+    };
+    if (!inside(header.keys_offset, header.size, header.key_width) || !inside(header.infos_offset, header.size, header.info_width)
+        || !inside(header.index_keys_offset, header.index_size + 1, header.key_width)
+        || !inside(header.index_positions_offset, header.index_size + 1, sizeof(uint64_t))
+        || !inside(header.heap_offset, header.heap_size, 1))
+        return false;
+    const char* base = static_cast<const char*>(data_);
+    size_ = header.size;
+    index_size_ = header.index_size;
+    keys_ = reinterpret_cast<const typename KeyCodec::Stored*>(base + header.keys_offset);
+    infos_ = reinterpret_cast<const typename InfoCodec::Stored*>(base + header.infos_offset);
+    index_keys_ = reinterpret_cast<const typename KeyCodec::Stored*>(base + header.index_keys_offset);
+    index_positions_ = reinterpret_cast<const uint64_t*>(base + header.index_positions_offset);
+    heap_ = base + header.heap_offset;
+    // without strings there is nothing to check in the records and the loop compiles away
+    for (size_t i = 0; i < size_; i++) {
+        if (!KeyCodec::valid(keys_[i], header.heap_size) || !InfoCodec::valid(infos_[i], header.heap_size))
+            return false;
+    }
+    // _lowerBound() searches the kIndexStride keys before a position
+    for (size_t k = 1; k <= index_size_; k++) {
+        if (!KeyCodec::valid(index_keys_[k], header.heap_size) || index_positions_[k] >= size_ || index_positions_[k] % MappedFileHeader::kIndexStride)
+            return false;
+    }
+    return true;
+}
+
+template <typename Key, typename Info>
+void MappedDictionary<Key, Info>::_unmap()
+{
+    if (data_)
+        munmap(data_, length_);
+    data_ = nullptr;
+    length_ = size_ = index_size_ = 0;
+    keys_ = index_keys_ = nullptr;
+    infos_ = nullptr;
+    index_positions_ = nullptr;
+    heap_ = nullptr;
+}
+
+template <typename Key, typename Info>
+template <typename K>
+size_t MappedDictionary<Key, Info>::_lowerBound(const K& key) const
+{
+    constexpr size_t kStride = MappedFileHeader::kIndexStride;
+    constexpr size_t kLookahead = 64 / sizeof(typename KeyCodec::Stored) > 1 ? 64 / sizeof(typename KeyCodec::Stored) : 1;
+    // the Eytzinger index finds the first sampled key not less than key, as in FrozenDictionary
+    size_t k = 1;
+    while (k <= index_size_) {
+        __builtin_prefetch(index_keys_ + k * kLookahead);
+        k = 2 * k + (KeyCodec::decode(index_keys_[k], heap_) < key);
+    }
+    k >>= __builtin_ctzll(~k) + 1;
+    // the answer lies after the previous sample, at most kStride keys back
+    size_t hi = k ? index_positions_[k] : size_;
+    size_t lo = k ? (hi ? hi - kStride + 1 : 0) : (index_size_ ? (index_size_ - 1) * kStride + 1 : 0);
+    size_t base = lo;
+    size_t n = hi - lo;
+    while (n > 1) {
+        size_t half = n / 2;
+        base = _key(base + half) < key ? base + half : base;
+        n -= half;
+    }
+    return base + (n && _key(base) < key);
+}
+
+template <typename Key, typename Info>
+template <typename K>
+bool MappedDictionary<Key, Info>::contains(const K& key) const
+{
+    size_t i = _lowerBound(key);
+    return i < size_ && !(key < _key(i));
+}
+
+template <typename Key, typename Info>
+template <typename K>
+bool MappedDictionary<Key, Info>::find(const K& key, InfoView& info) const
+{
+    size_t i = _lowerBound(key);
+    if (i == size_ || key < _key(i))
+        return false;
+    info = InfoCodec::decode(infos_[i], heap_);
+    return true;
+}
+
+template <typename Key, typename Info>
+template <typename K>
+size_t MappedDictionary<Key, Info>::rank(const K& key) const
+{
+    return _lowerBound(key);
+}
+
+template <typename Key, typename Info>
+size_t MappedDictionary<Key, Info>::countRange(const Key& lo, const Key& hi) const
+{
+    if (!(lo < hi))
+        return 0;
+    return _lowerBound(hi) - _lowerBound(lo);
+}
+
+template <typename Key, typename Info>
+template <typename Function>
+void MappedDictionary<Key, Info>::forEachInRange(const Key& lo, const Key& hi, Function fn) const
+{
+    for (size_t i = _lowerBound(lo); i < size_ && _key(i) < hi; i++)
+        fn(_key(i), InfoCodec::decode(infos_[i], heap_));
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::join(Dictionary& right)
+{
+    if (&right == this)
+        return;
+    _adopt(right);
+    int height;
+    root_ = _join2(root_, _computeHeight(root_), right.root_, _computeHeight(right.root_), height);
+    right.root_ = nullptr;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::split(const Key& key, Dictionary& right)
+{
+    if (&right == this)
+        return;
+    right.destroy(right.root_);
+    _adopt(right);
+    Node* left = nullptr;
+    int left_height, right_height;
+    Node* middle = _split(root_, _computeHeight(root_), key, left, left_height, right.root_, right_height);
+    if (middle)
+        right.root_ = _join(nullptr, 0, middle, right.root_, right_height, right_height);
+    root_ = left;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::unionWith(Dictionary& other)
+{
+    if (&other == this)
+        return;
+    _adopt(other);
+    vector<Node*> garbage;
+    int height;
+    root_ = _union(root_, _computeHeight(root_), other.root_, _computeHeight(other.root_), height, garbage);
+    other.root_ = nullptr;
+    _collectGarbage(garbage);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::intersectionWith(Dictionary& other)
+{
+    if (&other == this)
+        return;
+    _adopt(other);
+    vector<Node*> garbage;
+    int height;
+    root_ = _intersection(root_, _computeHeight(root_), other.root_, _computeHeight(other.root_), height, garbage);
+    other.root_ = nullptr;
+    _collectGarbage(garbage);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::differenceWith(Dictionary& other)
+{
+    if (&other == this) {
+        destroy(root_);
+        return;
+    }
+    _adopt(other);
+    vector<Node*> garbage;
+    int height;
+    root_ = _difference(root_, _computeHeight(root_), other.root_, _computeHeight(other.root_), height, garbage);
+    other.root_ = nullptr;
+    _collectGarbage(garbage);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_adopt(Dictionary& other)
+{
+    // nodes are about to move between the trees, so both must be able to free them
+    if constexpr (is_arena<NodeAllocator>::value)
+        alloc_.merge(other.alloc_);
+    else
+        static_assert(NodeTraits::is_always_equal::value, "nodes can only move between trees with interchangeable allocators");
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_join(Node* left, int left_height, Node* middle, Node* right, int right_height, int& height)
+{
+    // middle goes between two trees of any heights; the taller one is descended until they fit
+    if (left_height > right_height + 1)
+        return _joinRight(left, left_height, middle, right, right_height, height);
+    if (right_height > left_height + 1)
+        return _joinLeft(left, left_height, middle, right, right_height, height);
+    middle->setLeft(left);
+    middle->setRight(right);
+    middle->setBalance(left_height - right_height);
+    _update(middle);
+    height = max(left_height, right_height) + 1;
+    return middle;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_joinRight(Node* left, int left_height, Node* middle, Node* right, int right_height, int& height)
+{
+    Node* spine = left->getRight();
+    int spine_height = _rightHeight(left, left_height);
+    int joined_height;
+    left->setRight(_join(spine, spine_height, middle, right, right_height, joined_height));
+    return _balance(left, _leftHeight(left, left_height), joined_height, height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_joinLeft(Node* left, int left_height, Node* middle, Node* right, int right_height, int& height)
+{
+    Node* spine = right->getLeft();
+    int spine_height = _leftHeight(right, right_height);
+    int joined_height;
+    right->setLeft(_join(left, left_height, middle, spine, spine_height, joined_height));
+    return _balance(right, joined_height, _rightHeight(right, right_height), height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_join2(Node* left, int left_height, Node* right, int right_height, int& height)
+{
+    if (!left || !right) {
+        height = left ? left_height : right_height;
+        return left ? left : right;
+    }
+    Node* middle;
+    right = _removeMin(right, right_height, middle, right_height);
+    return _join(left, left_height, middle, right, right_height, height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_split(Node* root, int height, const Key& key, Node*& left, int& left_height, Node*& right, int& right_height)
+{
+    // returns the node holding key, detached from both halves, or nullptr
+    if (!root) {
+        left = right = nullptr;
+        left_height = right_height = 0;
+        return nullptr;
+    }
+    Node* l = root->getLeft();
+    Node* r = root->getRight();
+    int l_height = _leftHeight(root, height);
+    int r_height = _rightHeight(root, height);
+    int order = _compare(key, root->getKey());
+    if (order < 0) {
+        Node* middle = _split(l, l_height, key, left, left_height, right, right_height);
+        right = _join(right, right_height, root, r, r_height, right_height);
+        return middle;
+    }
+    if (order > 0) {
+        Node* middle = _split(r, r_height, key, left, left_height, right, right_height);
+        left = _join(l, l_height, root, left, left_height, left_height);
+        return middle;
+    }
+    left = l;
+    left_height = l_height;
+    right = r;
+    right_height = r_height;
+    root->setLeft(nullptr);
+    root->setRight(nullptr);
+    root->setBalance(0);
+    _update(root);
+    return root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_union(Node* a, int a_height, Node* b, int b_height, int& height, vector<Node*>& garbage)
+{
+    if (!a || !b) {
+        height = a ? a_height : b_height;
+        return a ? a : b;
+    }
+    size_t work = _getSize(a) + _getSize(b);
+    Node* l1 = a->getLeft();
+    Node* r1 = a->getRight();
+    int l1_height = _leftHeight(a, a_height);
+    int r1_height = _rightHeight(a, a_height);
+    Node *l2, *r2;
+    int l2_height, r2_height;
+    if (Node* duplicate = _split(b, b_height, a->getKey(), l2, l2_height, r2, r2_height))
+        garbage.push_back(duplicate);
+    Node *left, *right;
+    int left_height, right_height;
+    _fork(
+        work, garbage, [&](vector<Node*>& g) { left = _union(l1, l1_height, l2, l2_height, left_height, g); },
+        [&](vector<Node*>& g) { right = _union(r1, r1_height, r2, r2_height, right_height, g); });
+    return _join(left, left_height, a, right, right_height, height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_intersection(Node* a, int a_height, Node* b, int b_height, int& height, vector<Node*>& garbage)
+{
+    if (!a || !b) {
+        if (a)
+            garbage.push_back(a);
+        if (b)
+            garbage.push_back(b);
+        height = 0;
+        return nullptr;
+    }
+    size_t work = _getSize(a) + _getSize(b);
+    Node* l1 = a->getLeft();
+    Node* r1 = a->getRight();
+    int l1_height = _leftHeight(a, a_height);
+    int r1_height = _rightHeight(a, a_height);
+    Node *l2, *r2;
+    int l2_height, r2_height;
+    Node* duplicate = _split(b, b_height, a->getKey(), l2, l2_height, r2, r2_height);
+    Node *left, *right;
+    int left_height, right_height;
+    _fork(
+        work, garbage, [&](vector<Node*>& g) { left = _intersection(l1, l1_height, l2, l2_height, left_height, g); },
+        [&](vector<Node*>& g) { right = _intersection(r1, r1_height, r2, r2_height, right_height, g); });
+    if (duplicate) {
+        garbage.push_back(duplicate);
+        return _join(left, left_height, a, right, right_height, height);
+    }
+    a->setLeft(nullptr);
+    a->setRight(nullptr);
+    garbage.push_back(a);
+    return _join2(left, left_height, right, right_height, height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_difference(Node* a, int a_height, Node* b, int b_height, int& height, vector<Node*>& garbage)
+{
+    if (!a || !b) {
+        if (b)
+            garbage.push_back(b);
+        height = a_height;
+        return a;
+    }
+    size_t work = _getSize(a) + _getSize(b);
+    Node* l2 = b->getLeft();
+    Node* r2 = b->getRight();
+    int l2_height = _leftHeight(b, b_height);
+    int r2_height = _rightHeight(b, b_height);
+    b->setLeft(nullptr);
+    b->setRight(nullptr);
+    garbage.push_back(b);
+    Node *l1, *r1;
+    int l1_height, r1_height;
+    if (Node* duplicate = _split(a, a_height, b->getKey(), l1, l1_height, r1, r1_height))
+        garbage.push_back(duplicate);
+    Node *left, *right;
+    int left_height, right_height;
+    _fork(
+        work, garbage, [&](vector<Node*>& g) { left = _difference(l1, l1_height, l2, l2_height, left_height, g); },
+        [&](vector<Node*>& g) { right = _difference(r1, r1_height, r2, r2_height, right_height, g); });
+    return _join2(left, left_height, right, right_height, height);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename Left, typename Right>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_fork(size_t work, vector<Node*>& garbage, Left left, Right right)
+{
+    if (work < kParallelCutoff) {
+        left(garbage);
+        right(garbage);
+        return;
+    }
+    // the halves touch disjoint nodes; only the garbage lists need to be kept apart
+    vector<Node*> right_garbage;
+    ForkJoinPool::shared().invoke([&]() { left(garbage); }, [&]() { right(right_garbage); });
+    garbage.insert(garbage.end(), right_garbage.begin(), right_garbage.end());
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_collectGarbage(vector<Node*>& garbage)
+{
+    // dropped subtrees are freed on the calling thread, the arena isn't thread-safe
+    for (Node* root : garbage)
+        destroy(root);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_rotateRight(Node* root)
+{
+    Node* new_root = root->getLeft();
+    root->setLeft(new_root->getRight());
+    new_root->setRight(root);
+    // balance factors are left to the caller, which knows the shape it started from
+    _update(root);
+    _update(new_root);
+    return new_root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::_rotateLeft(Node* root)
+{
+    Node* new_root = root->getRight();
+    root->setRight(new_root->getLeft());
+    new_root->setLeft(root);
+    _update(root);
+    _update(new_root);
+    return new_root;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+int Dictionary<Key, Info, Allocator, Stats, Compare>::_computeHeight(const Node* root)
+{
+    // heights aren't stored; walking down the taller side takes O(log n)
+    int height = 0;
+    for (; root; height++)
+        root = root->getBalance() < 0 ? root->getRight() : root->getLeft();
+    return height;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+int Dictionary<Key, Info, Allocator, Stats, Compare>::_leftHeight(const Node* root, int height)
+{
+    return height - 1 - (root->getBalance() < 0);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+int Dictionary<Key, Info, Allocator, Stats, Compare>::_rightHeight(const Node* root, int height)
+{
+    return height - 1 - (root->getBalance() > 0);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+int Dictionary<Key, Info, Allocator, Stats, Compare>::_bitWidth(size_t n)
+{
+    return n ? 64 - __builtin_clzll(n) : 0;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+size_t Dictionary<Key, Info, Allocator, Stats, Compare>::_getSize(const Node* root)
+{
+    if (!root)
+        return 0;
+    return root->getSize();
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_update(Node* root)
+{
+    root->setSize(1 + _getSize(root->getLeft()) + _getSize(root->getRight()));
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+size_t Dictionary<Key, Info, Allocator, Stats, Compare>::size() const
+{
+    return _getSize(root_);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+const typename Dictionary<Key, Info, Allocator, Stats, Compare>::Node* Dictionary<Key, Info, Allocator, Stats, Compare>::select(size_t k) const
+{
+    Node* current = root_;
+    while (current) {
+        size_t left = _getSize(current->getLeft());
+        if (k < left) {
+            current = current->getLeft();
+        } else if (k > left) {
+            k -= left + 1;
+            current = current->getRight();
+        } else {
+            return current;
+        }
+    }
+    return nullptr;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+size_t Dictionary<Key, Info, Allocator, Stats, Compare>::rank(const Key& key) const
+{
+    size_t smaller = 0;
+    Node* current = root_;
+    while (current) {
+        if (_less(current->getKey(), key)) {
+            smaller += _getSize(current->getLeft()) + 1;
+            current = current->getRight();
+        } else {
+            current = current->getLeft();
+        }
+    }
+    return smaller;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+size_t Dictionary<Key, Info, Allocator, Stats, Compare>::countRange(const Key& lo, const Key& hi) const
+{
+    if (!_less(lo, hi))
+        return 0;
+    return rank(hi) - rank(lo);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator Dictionary<Key, Info, Allocator, Stats, Compare>::begin() const
+{
+    const_iterator it(root_);
+    it._pushLeftmost(root_);
+    return it;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator Dictionary<Key, Info, Allocator, Stats, Compare>::end() const
+{
+    return const_iterator(root_);
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator Dictionary<Key, Info, Allocator, Stats, Compare>::lower_bound(const Key& key) const
+{
+    // the path to the answer is a prefix of the search path
+    const_iterator it(root_);
+    int found = 0;
+    for (const Node* current = root_; current;) {
+        it.path_[it.depth_++] = current;
+        if (_less(current->getKey(), key)) {
+            current = current->getRight();
+        } else {
+            found = it.depth_;
+            current = current->getLeft();
+        }
+    }
+    it.depth_ = found;
+    return it;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator Dictionary<Key, Info, Allocator, Stats, Compare>::upper_bound(const Key& key) const
+{
+    const_iterator it(root_);
+    int found = 0;
+    for (const Node* current = root_; current;) {
+        it.path_[it.depth_++] = current;
+        if (_less(key, current->getKey())) {
+            found = it.depth_;
+            current = current->getLeft();
+        } else {
+            current = current->getRight();
+        }
+    }
+    it.depth_ = found;
+    return it;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+pair<typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator, typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator> Dictionary<Key, Info, Allocator, Stats, Compare>::equal_range(const Key& key) const
+{
+    return { lower_bound(key), upper_bound(key) };
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+template <typename Function>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::forEachInRange(const Key& lo, const Key& hi, Function fn) const
+{
+    for (const_iterator it = lower_bound(lo); it.depth_ && _less(it->getKey(), hi); ++it)
+        fn(it->getKey(), it->getInfo());
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator& Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator::operator++()
+{
+    if (!depth_) {
+        _pushLeftmost(root_);
+        return *this;
+    }
+    const Node* node = path_[depth_ - 1];
+    if (node->getRight()) {
+        _pushLeftmost(node->getRight());
+        return *this;
+    }
+    // climb until we leave a left subtree; its parent is the successor
+    depth_--;
+    while (depth_ && path_[depth_ - 1]->getRight() == node)
+        node = path_[--depth_];
+    return *this;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+typename Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator& Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator::operator--()
+{
+    if (!depth_) {
+        _pushRightmost(root_);
+        return *this;
+    }
+    const Node* node = path_[depth_ - 1];
+    if (node->getLeft()) {
+        _pushRightmost(node->getLeft());
+        return *this;
+    }
+    depth_--;
+    while (depth_ && path_[depth_ - 1]->getLeft() == node)
+        node = path_[--depth_];
+    return *this;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator::_pushLeftmost(const Node* node)
+{
+    for (; node; node = node->getLeft())
+        path_[depth_++] = node;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::const_iterator::_pushRightmost(const Node* node)
+{
+    for (; node; node = node->getRight())
+        path_[depth_++] = node;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_printInOrder(Dictionary::Node* root) const
+{
+    if (root) {
+        _printInOrder(root->getLeft());
+        cout << root->getKey();
+        cout << root->getInfo();
+        cout << ", ";
+        _printInOrder(root->getRight());
+    }
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_printPreOrder(Dictionary::Node* root) const
+{
+    if (root) {
+        cout << root->getKey();
+        cout << root->getInfo();
+        cout << ", ";
+        _printInOrder(root->getLeft());
+        _printInOrder(root->getRight());
+    }
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_printPostOrder(Dictionary::Node* root) const
+{
+    if (root) {
+        _printInOrder(root->getLeft());
+        _printInOrder(root->getRight());
+        cout << root->getKey();
+        cout << root->getInfo();
+        cout << ", ";
+    }
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::printInOrder() const
+{
+    cout << "Printing in order: ";
+    _printInOrder(root_);
+    cout << endl;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::printPreOrder() const
+{
+    cout << "Printing pre order: ";
+    _printPreOrder(root_);
+    cout << endl;
+}
+
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::printPostOrder() const
+{
+    cout << "Printing post order: ";
+    _printPostOrder(root_);
+    cout << endl;
+}
 
-    Node* _rotateRight(Node* root);
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::display()
+{
+    _display(root_);
+}
 
-    Node* _rotateLeft(Node* root);
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_display(Dictionary::Node* root)
+{
+    int height = _computeHeight(root);
+    for (int i = 1; i <= height; i++) {
+        cout << "(Level: " << i << ") ";
+        _printLevels(root, i);
+        cout << endl;
+    }
+}
 
-    int _getHeight(Node* root_);
+template <typename Key, typename Info, template <typename> class Allocator, typename Stats, typename Compare>
+void Dictionary<Key, Info, Allocator, Stats, Compare>::_printLevels(Dictionary::Node* root, int height)
+{
+    if (!root)
+        return;
+    if (height == 1)
+        cout << root->getKey() << " ";
+    else {
+        _printLevels(root->getLeft(), height - 1);
+        _printLevels(root->getRight(), height - 1);
+    }
+}
 
-    void _printInOrder(Node* root) const;
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+CompactDictionary<Key, Info, kFlatLimit, Compare>::~CompactDictionary()
+{
+    _destroyFlat();
+}
 
-    void _printPreOrder(Node* root) const;
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::insert(const Key& key, const Info& info)
+{
+    _insert(key, info);
+}
 
-    void _printPostOrder(Node* root) const;
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::insert(Key&& key, Info&& info)
+{
+    _insert(move(key), move(info));
+}
 
-    void _printLevels(Node* root, int height);
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+template <typename K, typename I>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::_insert(K&& key, I&& info)
+{
+    if (!tree_) {
+        size_t position = _lowerBound(key);
+        if (position < count_ && !_less(key, _keys()[position]))
+            return;
+        if (count_ < kFlatLimit) {
+            Key* keys = _keys();
+            Info* infos = _infos();
+            // open a slot at position by shifting the tail one place up
+            for (size_t i = count_; i > position; i--) {
+                new (&keys[i]) Key(move(keys[i - 1]));
+                keys[i - 1].~Key();
+                new (&infos[i]) Info(move(infos[i - 1]));
+                infos[i - 1].~Info();
+            }
+            new (&keys[position]) Key(forward<K>(key));
+            new (&infos[position]) Info(forward<I>(info));
+            count_++;
+            return;
+        }
+        _toTree();
+    }
+    tree_->insert(Key(forward<K>(key)), Info(forward<I>(info)));
+}
 
-    void _display(Dictionary::Node* root);
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+template <typename K>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::remove(const K& key)
+{
+    if (tree_) {
+        tree_->remove(key);
+        if (tree_->size() <= kShrinkLimit)
+            _toFlat();
+        return;
+    }
+    size_t position = _lowerBound(key);
+    if (position == count_ || _less(key, _keys()[position]))
+        return;
+    Key* keys = _keys();
+    Info* infos = _infos();
+    keys[position].~Key();
+    infos[position].~Info();
+    for (size_t i = position + 1; i < count_; i++) {
+        new (&keys[i - 1]) Key(move(keys[i]));
+        keys[i].~Key();
+        new (&infos[i - 1]) Info(move(infos[i]));
+        infos[i].~Info();
+    }
+    count_--;
+}
 
-public:
-    Dictionary();
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+template <typename K>
+Info* CompactDictionary<Key, Info, kFlatLimit, Compare>::find(const K& key)
+{
+    return const_cast<Info*>(static_cast<const CompactDictionary*>(this)->find(key));
+}
 
-    ~Dictionary();
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+template <typename K>
+const Info* CompactDictionary<Key, Info, kFlatLimit, Compare>::find(const K& key) const
+{
+    if (tree_)
+        return tree_->find(key);
+    size_t position = _lowerBound(key);
+    if (position == count_ || _less(key, _keys()[position]))
+        return nullptr;
+    return &_infos()[position];
+}
 
-    void destroy(Node* root);
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+size_t CompactDictionary<Key, Info, kFlatLimit, Compare>::size() const
+{
+    return tree_ ? tree_->size() : count_;
+}
 
-    void insert(Key key, Info info);
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+template <typename Function>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::forEachInRange(const Key& lo, const Key& hi, Function fn) const
+{
+    if (tree_) {
+        tree_->forEachInRange(lo, hi, fn);
+        return;
+    }
+    for (size_t i = _lowerBound(lo); i < count_ && _less(_keys()[i], hi); i++)
+        fn(_keys()[i], _infos()[i]);
+}
 
-    void remove(Key key);
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+template <typename K>
+size_t CompactDictionary<Key, Info, kFlatLimit, Compare>::_lowerBound(const K& key) const
+{
+    const Key* keys = _keys();
+    if constexpr (is_arithmetic<Key>::value && is_arithmetic<K>::value) {
+        // counting the smaller keys has no branches and vectorizes; at this size it beats a binary search
+        size_t position = 0;
+        for (size_t i = 0; i < count_; i++)
+            position += _less(keys[i], key);
+        return position;
+    } else {
+        return std::lower_bound(keys, keys + count_, key, [](const Key& a, const K& b) { return _less(a, b); }) - keys;
+    }
+}
 
-    Info find(Key key) const;
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::_toTree()
+{
+    vector<pair<Key, Info>> entries;
+    entries.reserve(count_ + 1);
+    for (size_t i = 0; i < count_; i++)
+        entries.emplace_back(move(_keys()[i]), move(_infos()[i]));
+    _destroyFlat();
+    tree_ = make_unique<Tree>();
+    tree_->assign(make_move_iterator(entries.begin()), make_move_iterator(entries.end()));
+}
 
-    void printInOrder() const;
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::_toFlat()
+{
+    // the tree is freed right after, so its entries can be moved out
+    for (const auto& node : *tree_) {
+        new (&_keys()[count_]) Key(move(const_cast<Key&>(node.getKey())));
+        new (&_infos()[count_]) Info(move(const_cast<Info&>(node.getInfo())));
+        count_++;
+    }
+    tree_.reset();
+}
 
-    void printPreOrder() const;
+template <typename Key, typename Info, size_t kFlatLimit, typename Compare>
+void CompactDictionary<Key, Info, kFlatLimit, Compare>::_destroyFlat()
+{
+    for (size_t i = 0; i < count_; i++) {
+        _keys()[i].~Key();
+        _infos()[i].~Info();
+    }
+    count_ = 0;
+}
 
-    void printPostOrder() const;
+template <typename Key, typename Info, typename Compare>
+template <typename K, typename I>
+ConcurrentDictionary<Key, Info, Compare>::Node::Node(K&& key, I&& info, uint64_t version)
+    : key_(forward<K>(key))
+    , info_(forward<I>(info))
+    , left_(nullptr)
+    , right_(nullptr)
+    , height_(1)
+    , version_(version)
+{
+}
 
-    void display();
-};
+template <typename Key, typename Info, typename Compare>
+ConcurrentDictionary<Key, Info, Compare>::ReadGuard::ReadGuard(const ConcurrentDictionary& dictionary)
+    : slot_(dictionary.readers_[_readerIndex()])
+    , overflow_(&slot_ == &dictionary.readers_[kMaxReaders] ? &dictionary.overflow_ : nullptr)
+{
+    // the shared slot keeps the epoch of its oldest guard until all of them are gone
+    if (overflow_)
+        overflow_->lock();
+    if (slot_.depth++ == 0)
+        slot_.epoch.store(dictionary.epoch_.load());
+    if (overflow_)
+        overflow_->unlock();
+    root_ = dictionary.root_.load();
+}
 
-int main()
+template <typename Key, typename Info, typename Compare>
+ConcurrentDictionary<Key, Info, Compare>::ReadGuard::~ReadGuard()
 {
-    Dictionary<string, int> dictionary;
-    dictionary.insert("aa", 1);
-    dictionary.insert("dd", 2);
-    dictionary.insert("bb", 3);
-    dictionary.insert("ee", 4);
-    dictionary.insert("cc", 5);
-    dictionary.remove("cc");
-    dictionary.printInOrder();
-    dictionary.printPostOrder();
-    dictionary.printPreOrder();
-    dictionary.display();
+    if (overflow_)
+        overflow_->lock();
+    if (--slot_.depth == 0)
+        slot_.epoch.store(0);
+    if (overflow_)
+        overflow_->unlock();
+}
 
-    cout << "Info of key: aa: ";
-    cout << dictionary.find("aa") << endl;
-    cout << "Info of key: ee: ";
-    cout << dictionary.find("ee") << endl;
+template <typename Key, typename Info, typename Compare>
+size_t ConcurrentDictionary<Key, Info, Compare>::_readerIndex()
+{
+    // every thread claims one slot index for as long as it lives, or gets
+    // the shared kMaxReaders slot when all of them are taken
+    static atomic<bool> claimed[kMaxReaders];
+    struct Registration {
+        size_t index = 0;
 
-    Dictionary<int, int> numbers;
-    numbers.insert(1, 10);
-    numbers.remove(1);
-    numbers.insert(2, 10);
-    numbers.insert(3, 10);
-    numbers.insert(4, 10);
-    numbers.insert(5, 10);
-    numbers.insert(6, 10);
-    numbers.insert(7, 10);
-    numbers.insert(8, 10);
-    numbers.insert(9, 10);
-    numbers.printInOrder();
-    numbers.printPostOrder();
-    numbers.printPreOrder();
-    numbers.display();
+        Registration()
+        {
+            for (bool expected = false; index < kMaxReaders && !claimed[index].compare_exchange_strong(expected, true); expected = false)
+                index++;
+        }
 
-    cout << "Info of key 6: ";
-    cout << numbers.find(6) << endl;
-    cout << "Info of non-existing key: ";
-    cout << numbers.find(100) << endl;
+        ~Registration()
+        {
+            if (index < kMaxReaders)
+                claimed[index].store(false);
+        }
+    };
+    thread_local Registration registration;
+    return registration.index;
+}
 
-    Dictionary<string, int> test;
-    test.insert("word1", 0);
-    test.insert("word1", 0);
-    test.insert("word2", 0); // node with the same key is not inserted the second time
-    test.printInOrder();
-    test.remove("word1");
-    test.remove("word2");
-    test.printInOrder();
-    test.display();
+template <typename Key, typename Info, typename Compare>
+ConcurrentDictionary<Key, Info, Compare>::~ConcurrentDictionary()
+{
+    _destroy(root_.load());
+    for (Retired& retired : retired_) {
+        for (Node* node : retired.nodes)
+            delete node;
+    }
 }
 
-template <typename Key, typename Info>
-Dictionary<Key, Info>::Dictionary()
+template <typename Key, typename Info, typename Compare>
+void ConcurrentDictionary<Key, Info, Compare>::_destroy(Node* root)
 {
-    root_ = nullptr;
+    if (root) {
+        _destroy(root->getLeft());
+        _destroy(root->getRight());
+        delete root;
+    }
 }
 
-template <typename Key, typename Info>
-Dictionary<Key, Info>::~Dictionary()
+template <typename Key, typename Info, typename Compare>
+void ConcurrentDictionary<Key, Info, Compare>::insert(const Key& key, const Info& info)
 {
-    destroy(root_);
+    lock_guard<mutex> guard(writer_);
+    version_++;
+    _publish(_insert(root_.load(), key, info));
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::destroy(Dictionary::Node* root)
+template <typename Key, typename Info, typename Compare>
+void ConcurrentDictionary<Key, Info, Compare>::insert(Key&& key, Info&& info)
 {
-    if (root) {
-        destroy(root->getLeft());
-        destroy(root->getRight());
-        delete root;
-        root = nullptr;
-    }
+    lock_guard<mutex> guard(writer_);
+    version_++;
+    _publish(_insert(root_.load(), move(key), move(info)));
 }
 
-template <typename Key, typename Info>
-Dictionary<Key, Info>::Node::Node(Key key, Info info)
+template <typename Key, typename Info, typename Compare>
+void ConcurrentDictionary<Key, Info, Compare>::remove(const Key& key)
 {
-    key_ = key;
-    info_ = info;
-    height_ = 1;
-    left_ = nullptr;
-    right_ = nullptr;
+    lock_guard<mutex> guard(writer_);
+    version_++;
+    _publish(_remove(root_.load(), key));
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::insert(Key key, Info info)
+template <typename Key, typename Info, typename Compare>
+bool ConcurrentDictionary<Key, Info, Compare>::find(const Key& key, Info& info) const
 {
-    root_ = _insert(root_, key, info); // root_ is overwritten only if it's null, otherwise it stays the same
+    ReadGuard guard(*this);
+    const Node* current = guard.root();
+    while (current) {
+        int order = _compare(key, current->getKey());
+        if (order == 0) {
+            info = current->getInfo();
+            return true;
+        }
+        current = order < 0 ? current->getLeft() : current->getRight();
+    }
+    return false;
 }
 
-template <typename Key, typename Info>
-typename Dictionary<Key, Info>::Node* Dictionary<Key, Info>::_insert(Node* root, Key key, Info info)
+template <typename Key, typename Info, typename Compare>
+void ConcurrentDictionary<Key, Info, Compare>::_publish(Node* root)
 {
-    if (!root) {
-        Node* temp = new Node(key, info);
-        return temp;
+    if (root == root_.load())
+        return; // nothing changed, so nothing was copied
+    root_.store(root);
+    retired_.push_back({ epoch_.fetch_add(1), move(unlinked_) });
+    unlinked_.clear();
+
+    // readers that pinned an epoch before the nodes were retired may still hold them
+    uint64_t oldest = UINT64_MAX;
+    for (const ReaderSlot& slot : readers_) {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch && epoch < oldest)
+            oldest = epoch;
     }
-    if (key < root->getKey())
-        root->setLeft(_insert(root->getLeft(), key, info));
-    else if (key > root->getKey())
-        root->setRight(_insert(root->getRight(), key, info));
-    root->setHeight(1 + max(_getHeight(root->getLeft()), _getHeight(root->getRight())));
-    int b_factor = _getHeight(root->getLeft()) - _getHeight(root->getRight());
-    if (b_factor > 1) {
-        if (key < root->getLeft()->getKey()) {
-            return _rotateRight(root);
-        } else {
-            root->setLeft(_rotateLeft(root->getLeft()));
-            return _rotateRight(root);
-        }
-    } else if (b_factor < -1) {
-        if (key > root->getRight()->getKey()) {
-            return _rotateLeft(root);
-        } else {
-            root->setRight(_rotateRight(root->getRight()));
-            return _rotateLeft(root);
-        }
+    while (!retired_.empty() && retired_.front().epoch < oldest) {
+        for (Node* node : retired_.front().nodes)
+            delete node;
+        retired_.pop_front();
     }
-    return root;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::remove(Key key)
+template <typename Key, typename Info, typename Compare>
+typename ConcurrentDictionary<Key, Info, Compare>::Node* ConcurrentDictionary<Key, Info, Compare>::_mutable(Node* node)
 {
-    root_ = _remove(root_, key);
+    if (node->getVersion() == version_)
+        return node;
+    Node* copy = new Node(*node);
+    copy->setVersion(version_);
+    unlinked_.push_back(node);
+    return copy;
 }
 
-template <typename Key, typename Info>
-typename Dictionary<Key, Info>::Node* Dictionary<Key, Info>::_remove(Dictionary::Node* root, Key key)
+template <typename Key, typename Info, typename Compare>
+void ConcurrentDictionary<Key, Info, Compare>::_unlink(Node* node)
 {
+    if (node->getVersion() == version_)
+        delete node; // never published
+    else
+        unlinked_.push_back(node);
+}
+
+template <typename Key, typename Info, typename Compare>
+template <typename K, typename I>
+typename ConcurrentDictionary<Key, Info, Compare>::Node* ConcurrentDictionary<Key, Info, Compare>::_insert(Node* root, K&& key, I&& info)
+{
+    // the payloads are only consumed by the new leaf
     if (!root)
-        return nullptr;
-    if (key < root->getKey()) {
-        root->setLeft(_remove(root->getLeft(), key));
-    } else if (key > root->getKey()) {
-        root->setRight(_remove(root->getRight(), key));
+        return new Node(forward<K>(key), forward<I>(info), version_);
+    int order = _compare(key, root->getKey());
+    if (order < 0) {
+        Node* left = _insert(root->getLeft(), forward<K>(key), forward<I>(info));
+        if (left == root->getLeft())
+            return root; // key already present, the path stays shared
+        root = _mutable(root);
+        root->setLeft(left);
+    } else if (order > 0) {
+        Node* right = _insert(root->getRight(), forward<K>(key), forward<I>(info));
+        if (right == root->getRight())
+            return root;
+        root = _mutable(root);
+        root->setRight(right);
     } else {
-        Node* r = root->getRight();
-        if (!root->getRight()) {
-            Node* l = root->getLeft();
-            delete (root);
-            root = l;
-        } else if (!root->getLeft()) {
-            delete (root);
-            root = r;
-        } else {
-            while (!r->getLeft())
-                r = r->getLeft();
-            root->setKey(r->getKey());
-            root->setRight(_remove(root->getRight(), r->getKey()));
-        }
+        return root;
     }
+    return _rebalance(root);
+}
+
+template <typename Key, typename Info, typename Compare>
+typename ConcurrentDictionary<Key, Info, Compare>::Node* ConcurrentDictionary<Key, Info, Compare>::_remove(Node* root, const Key& key)
+{
     if (!root)
-        return root;
+        return nullptr;
+    int order = _compare(key, root->getKey());
+    if (order < 0) {
+        Node* left = _remove(root->getLeft(), key);
+        if (left == root->getLeft())
+            return root; // key not present
+        root = _mutable(root);
+        root->setLeft(left);
+    } else if (order > 0) {
+        Node* right = _remove(root->getRight(), key);
+        if (right == root->getRight())
+            return root;
+        root = _mutable(root);
+        root->setRight(right);
+    } else if (!root->getLeft() || !root->getRight()) {
+        Node* child = root->getLeft() ? root->getLeft() : root->getRight();
+        _unlink(root);
+        return child;
+    } else {
+        Node* successor = root->getRight();
+        while (successor->getLeft())
+            successor = successor->getLeft();
+        root = _mutable(root);
+        root->setKey(successor->getKey());
+        root->setInfo(successor->getInfo());
+        root->setRight(_remove(root->getRight(), successor->getKey()));
+    }
+    return _rebalance(root);
+}
+
+template <typename Key, typename Info, typename Compare>
+typename ConcurrentDictionary<Key, Info, Compare>::Node* ConcurrentDictionary<Key, Info, Compare>::_rebalance(Node* root)
+{
+    // root is private to the current write; children are copied only if a rotation moves them
     root->setHeight(1 + max(_getHeight(root->getLeft()), _getHeight(root->getRight())));
     int b_factor = _getHeight(root->getLeft()) - _getHeight(root->getRight());
     if (b_factor > 1) {
-        if (key > root->getLeft()->getKey()) {
-            return _rotateRight(root);
-        } else {
-            root->setLeft(_rotateLeft(root->getLeft()));
-            return _rotateRight(root);
-        }
+        Node* l = root->getLeft();
+        if (_getHeight(l->getLeft()) < _getHeight(l->getRight()))
+            root->setLeft(_rotateLeft(l));
+        return _rotateRight(root);
     } else if (b_factor < -1) {
-        if (key < root->getRight()->getKey()) {
-            return _rotateLeft(root);
-        } else {
-            root->setRight(_rotateRight(root->getRight()));
-            return _rotateLeft(root);
-        }
+        Node* r = root->getRight();
+        if (_getHeight(r->getRight()) < _getHeight(r->getLeft()))
+            root->setRight(_rotateRight(r));
+        return _rotateLeft(root);
     }
     return root;
 }
 
-template <typename Key, typename Info>
-Info Dictionary<Key, Info>::find(const Key key) const
-{
-    Node* current;
-    bool found = false;
-    if (!root_)
-        cout << "find(): the tree is empty!" << endl;
-    else {
-        current = root_;
-        while (current && !found) {
-            if (current->getKey() == key)
-                found = true;
-            else if (current->getKey() > key)
-                current = current->getLeft();
-            else
-                current = current->getRight();
-        }
-    }
-    if (found)
-        return current->getInfo();
-}
-
-template <typename Key, typename Info>
-typename Dictionary<Key, Info>::Node* Dictionary<Key, Info>::_rotateRight(Node* root)
+template <typename Key, typename Info, typename Compare>
+typename ConcurrentDictionary<Key, Info, Compare>::Node* ConcurrentDictionary<Key, Info, Compare>::_rotateRight(Node* root)
 {
-    Node* new_root = root->getLeft();
+    root = _mutable(root);
+    Node* new_root = _mutable(root->getLeft());
     root->setLeft(new_root->getRight());
     new_root->setRight(root);
     root->setHeight(1 + max(_getHeight(root->getLeft()), _getHeight(root->getRight())));
@@ -325,10 +3575,11 @@ typename Dictionary<Key, Info>::Node* Dictionary<Key, Info>::_rotateRight(Node*
     return new_root;
 }
 
-template <typename Key, typename Info>
-typename Dictionary<Key, Info>::Node* Dictionary<Key, Info>::_rotateLeft(Node* root)
+template <typename Key, typename Info, typename Compare>
+typename ConcurrentDictionary<Key, Info, Compare>::Node* ConcurrentDictionary<Key, Info, Compare>::_rotateLeft(Node* root)
 {
-    Node* new_root = root->getRight();
+    root = _mutable(root);
+    Node* new_root = _mutable(root->getRight());
     root->setRight(new_root->getLeft());
     new_root->setLeft(root);
     root->setHeight(1 + max(_getHeight(root->getLeft()), _getHeight(root->getRight())));
@@ -336,100 +3587,142 @@ typename Dictionary<Key, Info>::Node* Dictionary<Key, Info>::_rotateLeft(Node* r
     return new_root;
 }
 
-template <typename Key, typename Info>
-int Dictionary<Key, Info>::_getHeight(Node* root)
+template <typename Key, typename Info, typename Compare>
+int ConcurrentDictionary<Key, Info, Compare>::_getHeight(const Node* root) const
 {
     if (!root)
         return 0;
     return root->getHeight();
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::_printInOrder(Dictionary::Node* root) const
+template <typename Key, typename Info, size_t N>
+ShardedDictionary<Key, Info, N>::ShardedDictionary(const array<Key, N - 1>& splits)
+    : splits_(splits)
+    , ranged_(true)
 {
-    if (root) {
-        _printInOrder(root->getLeft());
-        cout << root->getKey();
-        cout << root->getInfo();
-        cout << ", ";
-        _printInOrder(root->getRight());
-    }
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::_printPreOrder(Dictionary::Node* root) const
+template <typename Key, typename Info, size_t N>
+size_t ShardedDictionary<Key, Info, N>::_shardOf(const Key& key) const
 {
-    if (root) {
-        cout << root->getKey();
-        cout << root->getInfo();
-        cout << ", ";
-        _printInOrder(root->getLeft());
-        _printInOrder(root->getRight());
-    }
+    if (ranged_)
+        return upper_bound(splits_.begin(), splits_.end(), key) - splits_.begin();
+    // std::hash is often the identity; mixing spreads sequential keys over all shards
+    uint64_t hash = static_cast<uint64_t>(std::hash<Key>()(key)) * 0x9E3779B97F4A7C15ull;
+    return (hash >> 32) % N;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::_printPostOrder(Dictionary::Node* root) const
+template <typename Key, typename Info, size_t N>
+unique_lock<shared_mutex> ShardedDictionary<Key, Info, N>::_lockForWriting(Shard& shard)
 {
-    if (root) {
-        _printInOrder(root->getLeft());
-        _printInOrder(root->getRight());
-        cout << root->getKey();
-        cout << root->getInfo();
-        cout << ", ";
+    unique_lock<shared_mutex> guard(shard.lock, try_to_lock);
+    if (!guard.owns_lock()) {
+        shard.contended.fetch_add(1, memory_order_relaxed);
+        guard.lock();
     }
+    shard.writes.fetch_add(1, memory_order_relaxed);
+    return guard;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::printInOrder() const
+template <typename Key, typename Info, size_t N>
+shared_lock<shared_mutex> ShardedDictionary<Key, Info, N>::_lockForReading(const Shard& shard) const
 {
-    cout << "Printing in order: ";
-    _printInOrder(root_);
-    cout << endl;
+    shared_lock<shared_mutex> guard(shard.lock, try_to_lock);
+    if (!guard.owns_lock()) {
+        shard.contended.fetch_add(1, memory_order_relaxed);
+        guard.lock();
+    }
+    shard.reads.fetch_add(1, memory_order_relaxed);
+    return guard;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::printPreOrder() const
+template <typename Key, typename Info, size_t N>
+bool ShardedDictionary<Key, Info, N>::insert(const Key& key, const Info& info)
 {
-    cout << "Printing pre order: ";
-    _printPreOrder(root_);
-    cout << endl;
+    Shard& shard = shards_[_shardOf(key)];
+    unique_lock<shared_mutex> guard = _lockForWriting(shard);
+    return shard.dictionary.try_emplace(key, info).second;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::printPostOrder() const
+template <typename Key, typename Info, size_t N>
+bool ShardedDictionary<Key, Info, N>::remove(const Key& key)
 {
-    cout << "Printing post order: ";
-    _printPostOrder(root_);
-    cout << endl;
+    Shard& shard = shards_[_shardOf(key)];
+    unique_lock<shared_mutex> guard = _lockForWriting(shard);
+    size_t before = shard.dictionary.size();
+    shard.dictionary.remove(key);
+    return shard.dictionary.size() != before;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::display()
+template <typename Key, typename Info, size_t N>
+bool ShardedDictionary<Key, Info, N>::find(const Key& key, Info& info) const
 {
-    _display(root_);
+    const Shard& shard = shards_[_shardOf(key)];
+    shared_lock<shared_mutex> guard = _lockForReading(shard);
+    const Info* found = shard.dictionary.find(key);
+    if (!found)
+        return false;
+    info = *found;
+    return true;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::_display(Dictionary::Node* root)
+template <typename Key, typename Info, size_t N>
+size_t ShardedDictionary<Key, Info, N>::size() const
 {
-    int height = _getHeight(root);
-    for (int i = 1; i <= height; i++) {
-        cout << "(Level: " << i << ") ";
-        _printLevels(root, i);
-        cout << endl;
+    size_t total = 0;
+    for (const Shard& shard : shards_) {
+        shared_lock<shared_mutex> guard(shard.lock);
+        total += shard.dictionary.size();
     }
+    return total;
 }
 
-template <typename Key, typename Info>
-void Dictionary<Key, Info>::_printLevels(Dictionary::Node* root, int height)
+template <typename Key, typename Info, size_t N>
+template <typename Function>
+void ShardedDictionary<Key, Info, N>::forEach(Function fn) const
 {
-    if (!root)
+    using Iterator = typename Dictionary<Key, Info>::const_iterator;
+    // shards are always locked in index order, so concurrent forEach calls can't deadlock
+    shared_lock<shared_mutex> guards[N];
+    Iterator positions[N];
+    for (size_t i = 0; i < N; i++) {
+        guards[i] = _lockForReading(shards_[i]);
+        positions[i] = shards_[i].dictionary.begin();
+    }
+    if (ranged_) {
+        for (const Shard& shard : shards_) {
+            for (const auto& node : shard.dictionary)
+                fn(node.getKey(), node.getInfo());
+        }
         return;
-    if (height == 1)
-        cout << root->getKey() << " ";
-    else {
-        _printLevels(root->getLeft(), height - 1);
-        _printLevels(root->getRight(), height - 1);
     }
+    // hashed shards are merged; N is small, so a linear scan for the minimum beats a heap
+    while (true) {
+        size_t next = N;
+        for (size_t i = 0; i < N; i++) {
+            if (positions[i] != shards_[i].dictionary.end() && (next == N || positions[i]->getKey() < positions[next]->getKey()))
+                next = i;
+        }
+        if (next == N)
+            return;
+        fn(positions[next]->getKey(), positions[next]->getInfo());
+        ++positions[next];
+    }
+}
+
+template <typename Key, typename Info, size_t N>
+array<ShardStats, N> ShardedDictionary<Key, Info, N>::stats() const
+{
+    array<ShardStats, N> stats;
+    for (size_t i = 0; i < N; i++) {
+        const Shard& shard = shards_[i];
+        {
+            shared_lock<shared_mutex> guard(shard.lock);
+            stats[i].size = shard.dictionary.size();
+        }
+        stats[i].reads = shard.reads.load(memory_order_relaxed);
+        stats[i].writes = shard.writes.load(memory_order_relaxed);
+        stats[i].contended = shard.contended.load(memory_order_relaxed);
+    }
+    return stats;
 }
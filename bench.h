@@ -0,0 +1,19 @@
+// Timing shared by the *-bench.cpp programs.
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <chrono>
+#include <cstddef>
+
+// Runs fn once and returns the wall time it took in nanoseconds, divided by
+// the number of operations it performed
+template <typename Function>
+double NanosecondsPerOp(size_t ops, Function fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ops;
+}
+
+#endif  // BENCH_H_
@@ -0,0 +1,246 @@
+// Buffered export shared by the containers. Elements are formatted into one
+// reusable buffer that is handed to a sink only when it fills up or on Flush(),
+// so exporting costs one write per buffer instead of a flush per element.
+#ifndef BUFFERED_WRITER_H_
+#define BUFFERED_WRITER_H_
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+// Destination of a BufferedWriter
+class Sink {
+ public:
+  virtual ~Sink() = default;
+  // Returns false if not every byte could be written
+  virtual bool Write(const char* data, size_t size) = 0;
+};
+
+class FdSink : public Sink {
+ public:
+  explicit FdSink(int fd) : fd_(fd) {}
+  bool Write(const char* data, size_t size) override {
+    while (size) {
+      ssize_t written = ::write(fd_, data, size);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+ private:
+  int fd_;
+};
+
+class FileSink : public Sink {
+ public:
+  explicit FileSink(FILE* file) : file_(file) {}
+  bool Write(const char* data, size_t size) override {
+    return fwrite(data, 1, size, file_) == size;
+  }
+
+ private:
+  FILE* file_;
+};
+
+class MemorySink : public Sink {
+ public:
+  bool Write(const char* data, size_t size) override {
+    data_.append(data, size);
+    return true;
+  }
+  const std::string& data() const { return data_; }
+  void Clear() { data_.clear(); }
+
+ private:
+  std::string data_;
+};
+
+class OstreamSink : public Sink {
+ public:
+  explicit OstreamSink(std::ostream& out) : out_(out) {}
+  bool Write(const char* data, size_t size) override {
+    out_.write(data, size);
+    return bool(out_);
+  }
+
+ private:
+  std::ostream& out_;
+};
+
+// Text is "key: info" per line. Csv is "key,info" per line, with fields quoted
+// when needed. Binary is the key followed by the info, arithmetic types as
+// their bytes in host order and anything else as a uint32_t byte count
+// followed by its text.
+enum class ExportFormat { kText, kCsv, kBinary };
+
+class BufferedWriter {
+ public:
+  static constexpr size_t kDefaultCapacity = 1 << 16;
+
+  explicit BufferedWriter(Sink& sink, size_t capacity = kDefaultCapacity)
+      : sink_(sink), buffer_(std::max(capacity, kMaxNumberLength)) {}
+  BufferedWriter(const BufferedWriter&) = delete;
+  BufferedWriter& operator=(const BufferedWriter&) = delete;
+  ~BufferedWriter() { Flush(); }
+
+  // false once a write to the sink has failed
+  bool ok() const { return ok_; }
+
+  void Append(char c) {
+    if (used_ == buffer_.size()) Flush();
+    buffer_[used_++] = c;
+  }
+
+  void Append(std::string_view text) { AppendRaw(text.data(), text.size()); }
+
+  void AppendRaw(const void* data, size_t size) {
+    if (size > buffer_.size() - used_) {
+      Flush();
+      // too big to be worth copying
+      if (size >= buffer_.size()) {
+        if (ok_) ok_ = sink_.Write(static_cast<const char*>(data), size);
+        return;
+      }
+    }
+    memcpy(buffer_.data() + used_, data, size);
+    used_ += size;
+  }
+
+  template <typename T>
+  void AppendNumber(T value) {
+    static_assert(std::is_arithmetic<T>::value, "AppendNumber needs a number");
+    if (buffer_.size() - used_ < kMaxNumberLength) Flush();
+    char* first = buffer_.data() + used_;
+    if constexpr (std::is_same<T, bool>::value) {
+      *first = value ? '1' : '0';
+      used_++;
+    } else {
+      used_ = std::to_chars(first, first + kMaxNumberLength, value).ptr -
+              buffer_.data();
+    }
+  }
+
+  // Numbers go through to_chars, strings are copied as they are and other
+  // types are written with their operator<<
+  template <typename T>
+  void AppendText(const T& value) {
+    if constexpr (std::is_same<T, char>::value) {
+      Append(value);
+    } else if constexpr (std::is_arithmetic<T>::value) {
+      AppendNumber(value);
+    } else if constexpr (std::is_convertible<const T&,
+                                              std::string_view>::value) {
+      Append(std::string_view(value));
+    } else {
+      std::ostringstream out;
+      out << value;
+      Append(out.str());
+    }
+  }
+
+  // One field, quoted when it holds a comma, a quote or a line break
+  template <typename T>
+  void AppendCsv(const T& value) {
+    if constexpr (std::is_same<T, char>::value) {
+      AppendCsvField(std::string_view(&value, 1));
+    } else if constexpr (std::is_arithmetic<T>::value) {
+      AppendNumber(value);
+    } else if constexpr (std::is_convertible<const T&,
+                                              std::string_view>::value) {
+      AppendCsvField(std::string_view(value));
+    } else {
+      std::ostringstream out;
+      out << value;
+      AppendCsvField(out.str());
+    }
+  }
+
+  // Quotes the field in place, copying the runs between its quotes
+  void AppendCsvField(std::string_view field) {
+    if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+      Append(field);
+      return;
+    }
+    Append('"');
+    for (size_t quote; (quote = field.find('"')) != std::string_view::npos;
+         field.remove_prefix(quote + 1)) {
+      Append(field.substr(0, quote + 1));
+      Append('"');
+    }
+    Append(field);
+    Append('"');
+  }
+
+  template <typename T>
+  void AppendBinary(const T& value) {
+    if constexpr (std::is_arithmetic<T>::value) {
+      AppendRaw(&value, sizeof(value));
+    } else if constexpr (std::is_convertible<const T&,
+                                              std::string_view>::value) {
+      std::string_view text(value);
+      uint32_t size = text.size();
+      AppendRaw(&size, sizeof(size));
+      Append(text);
+    } else {
+      std::ostringstream out;
+      out << value;
+      AppendBinary(out.str());
+    }
+  }
+
+  template <typename Key, typename Info>
+  void AppendRecord(const Key& key, const Info& info, ExportFormat format) {
+    switch (format) {
+      case ExportFormat::kText:
+        AppendText(key);
+        Append(": ");
+        AppendText(info);
+        Append('\n');
+        break;
+      case ExportFormat::kCsv:
+        AppendCsv(key);
+        Append(',');
+        AppendCsv(info);
+        Append('\n');
+        break;
+      case ExportFormat::kBinary:
+        AppendBinary(key);
+        AppendBinary(info);
+        break;
+    }
+  }
+
+  // Hands the buffered bytes to the sink; returns ok()
+  bool Flush() {
+    if (used_ && ok_) ok_ = sink_.Write(buffer_.data(), used_);
+    used_ = 0;
+    return ok_;
+  }
+
+ private:
+  // enough for any integer and the shortest round trip of any double
+  static constexpr size_t kMaxNumberLength = 64;
+
+  Sink& sink_;
+  std::vector<char> buffer_;
+  size_t used_ = 0;
+  bool ok_ = true;
+};
+
+#endif  // BUFFERED_WRITER_H_
@@ -0,0 +1,80 @@
+/** Benchmark of Dictionary lookups by comparator policy
+ Finds n random keys, all present, in Dictionary<int, int> and
+ Dictionary<uint64_t, uint64_t> with the default ThreeWayCompare, with a
+ comparator branching on operator< twice per level the way the tree used to
+ compare, and in std::map.
+ Build: g++ -std=c++17 -O2 -pthread compare-bench.cpp
+ Usage: ./a.out [n] [rounds]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <map>
+#include <random>
+
+struct BranchingCompare {
+    template <typename A, typename B>
+    int operator()(const A& a, const B& b) const
+    {
+        if (a < b)
+            return -1;
+        if (b < a)
+            return 1;
+        return 0;
+    }
+};
+
+template <typename Map, typename Key>
+double lookup(const Map& container, const vector<Key>& probes, int rounds)
+{
+    double best = 1e300;
+    size_t found = 0;
+    for (int i = 0; i < rounds; i++) {
+        best = min(best, NanosecondsPerOp(probes.size(), [&] {
+            for (const Key& key : probes) {
+                if constexpr (is_same<Map, map<Key, Key>>::value)
+                    found += container.find(key) != container.end();
+                else
+                    found += container.find(key) != nullptr;
+            }
+        }));
+    }
+    if (found != rounds * probes.size())
+        printf("lookups missed keys!\n");
+    return best;
+}
+
+template <typename Key>
+void benchmark(const char* name, size_t n, int rounds)
+{
+    mt19937_64 random(42);
+    Dictionary<Key, Key> threeWay;
+    Dictionary<Key, Key, NodePool, NoStats, BranchingCompare> branching;
+    map<Key, Key> reference;
+    vector<Key> probes;
+    while (probes.size() < n) {
+        Key key = static_cast<Key>(random());
+        if (reference.emplace(key, key).second) {
+            threeWay.insert(key, key);
+            branching.insert(key, key);
+            probes.push_back(key);
+        }
+    }
+    shuffle(probes.begin(), probes.end(), random);
+    double threeWayTime = lookup(threeWay, probes, rounds);
+    double branchingTime = lookup(branching, probes, rounds);
+    double mapTime = lookup(reference, probes, rounds);
+    printf("%-9s ThreeWayCompare %7.1f  BranchingCompare %7.1f  std::map %7.1f ns/find   node %zu bytes\n", name, threeWayTime, branchingTime, mapTime,
+        sizeof(typename Dictionary<Key, Key>::Node));
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 3;
+    printf("n=%zu, best of %d rounds\n", n, rounds);
+    benchmark<int>("int", n, rounds);
+    benchmark<uint64_t>("uint64_t", n, rounds);
+}
@@ -0,0 +1,70 @@
+/** Reader-scaling benchmark of ConcurrentDictionary
+ N reader threads look up random keys in a dictionary preloaded with half of
+ the key space while one writer thread keeps inserting and removing random
+ keys, until every reader is done. Reports lookups per second over all
+ readers and per reader for each reader count, and the writes completed
+ meanwhile.
+ Build: g++ -std=c++17 -O2 -pthread concurrent-bench.cpp
+ Usage: ./a.out [lookups per reader] [max readers]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <random>
+
+constexpr int kKeySpace = 1 << 20;
+
+void benchmark(int readers, size_t lookups)
+{
+    ConcurrentDictionary<int, int> dictionary;
+    for (int key = 0; key < kKeySpace; key += 2)
+        dictionary.insert(key, key);
+
+    atomic<bool> done { false };
+    size_t writes = 0;
+    thread writer([&dictionary, &done, &writes] {
+        mt19937 random(1000);
+        while (!done.load(memory_order_relaxed)) {
+            int key = random() % kKeySpace;
+            if (key % 4 < 2)
+                dictionary.insert(key, key);
+            else
+                dictionary.remove(key);
+            writes++;
+        }
+    });
+
+    atomic<size_t> found { 0 };
+    double time = NanosecondsPerOp(readers * lookups, [&] {
+        vector<thread> workers;
+        for (int t = 0; t < readers; t++) {
+            workers.emplace_back([&dictionary, &found, t, lookups] {
+                mt19937 random(t);
+                size_t hits = 0;
+                int info;
+                for (size_t i = 0; i < lookups; i++)
+                    hits += dictionary.find(random() % kKeySpace, info);
+                found += hits;
+            });
+        }
+        for (thread& worker : workers)
+            worker.join();
+    });
+    done = true;
+    writer.join();
+
+    double total = 1e9 / time;
+    printf("readers %2d   %8.2f M lookups/s   %7.2f M lookups/s per reader   %zu writes   hit rate %4.1f%%\n", readers, total / 1e6, total / readers / 1e6, writes,
+        100.0 * found.load() / (readers * lookups));
+}
+
+int main(int argc, char** argv)
+{
+    size_t lookups = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    int maxReaders = argc > 2 ? atoi(argv[2]) : 8;
+    printf("%u hardware threads, %zu lookups per reader, one writer\n", thread::hardware_concurrency(), lookups);
+    for (int readers = 1; readers <= maxReaders; readers *= 2)
+        benchmark(readers, lookups);
+}
@@ -0,0 +1,75 @@
+// Throughput benchmark of Ring::Export. Exports a ring of n elements in each
+// format to a memory buffer and to /dev/null through a file descriptor, next
+// to the per-element `out << ... << endl` printing that export replaced,
+// whose output size isn't known and is reported per element only.
+// Build: g++ -std=c++17 -O2 -pthread export-bench.cpp
+// Usage: ./a.out [n]
+
+#define RING_NO_MAIN
+#include "ring.cpp"
+#include "bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <fcntl.h>
+
+// fn returns how many bytes it produced, or 0 if it can't tell
+template <typename Function>
+void Measure(const char* name, size_t n, Function fn) {
+  size_t bytes;
+  double time = NanosecondsPerOp(n, [&] { bytes = fn(); });
+  printf("%-30s %6.1f ns/element", name, time);
+  // bytes per nanosecond is GB/s
+  if (bytes) printf("  %7.1f MB/s", bytes / (time * n) * 1e3);
+  printf("\n");
+}
+
+template <typename Key, typename Info>
+void Benchmark(const char* name, const Ring<Key, Info>& ring) {
+  printf("%s\n", name);
+  const pair<const char*, ExportFormat> formats[] = {
+      {"text", ExportFormat::kText},
+      {"csv", ExportFormat::kCsv},
+      {"binary", ExportFormat::kBinary}};
+  MemorySink memory;
+  size_t bytes[3];
+  for (int f = 0; f < 3; f++) {
+    string label = string("  Export ") + formats[f].first + ", memory";
+    Measure(label.c_str(), ring.length(), [&] {
+      memory.Clear();
+      ring.Export(memory, formats[f].second);
+      return bytes[f] = memory.data().size();
+    });
+  }
+  int fd = open("/dev/null", O_WRONLY);
+  for (int f = 0; f < 3; f++) {
+    string label = string("  Export ") + formats[f].first + ", /dev/null";
+    Measure(label.c_str(), ring.length(), [&] {
+      FdSink sink(fd);
+      ring.Export(sink, formats[f].second);
+      return bytes[f];
+    });
+  }
+  close(fd);
+  ofstream out("/dev/null");
+  Measure("  ofstream with endl", ring.length(), [&] {
+    for (auto it = ring.const_begin(); it != ring.const_end(); ++it) {
+      out << *it << ": " << it.get_info() << endl;
+    }
+    return size_t(0);
+  });
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  Ring<uint64_t, double> numbers;
+  Ring<int, string> words;
+  for (size_t i = 0; i < n; i++) {
+    numbers.InsertAtEnd(i * 2654435761u, i / 7.0);
+    words.InsertAtEnd(int(i), i % 10 ? "plain word" : "needs, \"quotes\"");
+  }
+  Benchmark("Ring<uint64_t, double>", numbers);
+  Benchmark("Ring<int, string>", words);
+}
@@ -0,0 +1,52 @@
+/** Benchmark of FrozenDictionary against the pointer-based Dictionary
+ Looks up random keys, half of them present, in a tree of n entries and in
+ its frozen Eytzinger copy.
+ Build: g++ -std=c++17 -O2 -pthread frozen-bench.cpp
+ Usage: ./a.out [n]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <random>
+
+template <typename Key>
+void benchmark(const char* name, size_t n)
+{
+    mt19937_64 random(42);
+    Dictionary<Key, Key> dictionary;
+    vector<Key> probes;
+    // even keys are stored, odd ones miss
+    while (dictionary.size() < n) {
+        Key key = static_cast<Key>(random() % (4 * n)) & ~Key(1);
+        dictionary.insert(key, key);
+    }
+    for (size_t i = 0; i < n; i++)
+        probes.push_back(static_cast<Key>(random() % (4 * n)));
+    FrozenDictionary<Key, Key> frozen = dictionary.freeze();
+
+    size_t found = 0;
+    double tree = NanosecondsPerOp(probes.size(), [&] {
+        for (const Key& key : probes)
+            found += dictionary.find(key) != nullptr;
+    });
+    double flat = NanosecondsPerOp(probes.size(), [&] {
+        for (const Key& key : probes)
+            found -= frozen.find(key) != nullptr;
+    });
+    if (found)
+        printf("lookups disagree!\n");
+    printf("%-9s n=%-9zu Dictionary %7.1f ns/find  FrozenDictionary %7.1f ns/find  speedup %.2fx\n", name, n, tree, flat, tree / flat);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    for (size_t size = 1000; size < n; size *= 10) {
+        benchmark<int>("int", size);
+        benchmark<uint64_t>("uint64_t", size);
+    }
+    benchmark<int>("int", n);
+    benchmark<uint64_t>("uint64_t", n);
+}
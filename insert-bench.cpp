@@ -0,0 +1,70 @@
+/** Benchmark of Dictionary insert and remove against std::map
+ Runs n inserts followed by n removals of the same keys, drawn at random,
+ in sequential order and from a zipfian distribution (s = 0.99) over n
+ distinct keys, where popular keys are inserted and removed repeatedly.
+ Build: g++ -std=c++17 -O2 -pthread insert-bench.cpp
+ Usage: ./a.out [n]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <cmath>
+#include <map>
+#include <random>
+
+// n draws of ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s,
+// scattered over the key space so that popular keys aren't neighbours
+vector<int> zipfian(size_t n, double s, mt19937& random)
+{
+    vector<double> cdf(n);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+        cdf[i] = sum += 1 / pow(double(i + 1), s);
+    uniform_real_distribution<double> uniform(0, sum);
+    vector<int> keys(n);
+    for (int& key : keys) {
+        size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(random)) - cdf.begin();
+        key = static_cast<int>((rank * 2654435761u) % n);
+    }
+    return keys;
+}
+
+void benchmark(const char* name, const vector<int>& keys)
+{
+    Dictionary<int, int> dictionary;
+    map<int, int> reference;
+    double treeInsert = NanosecondsPerOp(keys.size(), [&] {
+        for (int key : keys)
+            dictionary.insert(key, key);
+    });
+    double mapInsert = NanosecondsPerOp(keys.size(), [&] {
+        for (int key : keys)
+            reference.emplace(key, key);
+    });
+    double treeRemove = NanosecondsPerOp(keys.size(), [&] {
+        for (int key : keys)
+            dictionary.remove(key);
+    });
+    double mapRemove = NanosecondsPerOp(keys.size(), [&] {
+        for (int key : keys)
+            reference.erase(key);
+    });
+    printf("%-10s insert: Dictionary %7.1f  std::map %7.1f ns/op   remove: Dictionary %7.1f  std::map %7.1f ns/op\n", name, treeInsert, mapInsert, treeRemove, mapRemove);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    mt19937 random(42);
+    printf("n=%zu, sizeof(Dictionary<int, int>::Node) = %zu\n", n, sizeof(Dictionary<int, int>::Node));
+
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(i);
+    benchmark("sequential", keys);
+    shuffle(keys.begin(), keys.end(), random);
+    benchmark("random", keys);
+    benchmark("zipfian", zipfian(n, 0.99, random));
+}
@@ -1,58 +1,188 @@
+#include <cstdint>
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "buffered-writer.h"
 
 using namespace std;
 
 void Warning(string s);
 void Info(string s);
 
+template <typename Key, typename Info>
+class SequenceView;
+
 template <typename Key, typename Info>
 class Sequence {
  public:
-  // The produce function
+  // The produce function, copying each node it keeps once
   Sequence<Key, Info> CombineSequences(Sequence& sequence1, int index1,
                                        const int length1, Sequence& sequence2,
                                        int index2, const int length2,
                                        int max_length);
-  // Returns copy of part of sequence elements of index: from index to
-  // index+length-1
-  Sequence<Key, Info> Trim(int index, const int length) const;
+  // Returns a view of part of sequence elements of index: from index to
+  // index+length-1, without copying them
+  SequenceView<Key, Info> Trim(int index, const int length) const;
   Sequence operator+(const Sequence& sequence) const;
 
-  Sequence();
+  // With index_keys, a hash index of the keys makes AddNode and RemoveNode
+  // O(1) expected; without it they walk the list to check the key.
+  explicit Sequence(bool index_keys = true);
+  Sequence(const Sequence& sequence);
+  // Leaves the other sequence empty; never allocates
+  Sequence(Sequence&& sequence) noexcept;
+  // Copies the nodes of the view
+  Sequence(const SequenceView<Key, Info>& view);
+  Sequence& operator=(Sequence sequence);
+
+  int length() const { return length_; }
+  // View of the whole sequence
+  SequenceView<Key, Info> View() const {
+    return SequenceView<Key, Info>(chain_, head(),
+                                   tail_ ? tail_->get_ordinal() : 0, length_,
+                                   index_keys_);
+  }
   // Adds node at the end of the list
-  void AddNode(Key key, Info info);
-  void RemoveNode(Key key);
+  void AddNode(const Key& key, const Info& info);
+  void RemoveNode(const Key& key);
   void Print();
+  // Writes every node in order, returns false if the sink failed
+  bool Export(Sink& sink, ExportFormat format = ExportFormat::kText) const;
 
  private:
+  friend class SequenceView<Key, Info>;
+
   // Every node has a unique key
   class Node {
    public:
-    Node(Key key, Info info);
-    void PrintNode();
+    Node(Key key, Info info, uint64_t ordinal);
+    void PrintNode(BufferedWriter& writer);
     void set_key(Key key);
     void set_info(Info info);
     void set_next(Node* next);
-    Key get_key() { return key; };
-    Info get_info() { return info; };
+    const Key& get_key() const { return key; };
+    const Info& get_info() const { return info; };
     Node* get_next() { return next; }
+    uint64_t get_ordinal() const { return ordinal; }
 
    private:
     Key key;
     Info info;
     Node* next;
+    uint64_t ordinal;  // position in the order the chain's nodes were added
+  };
+
+  // Open addressing with linear probing. A slot maps a key to its node and to
+  // the node before it, which RemoveNode needs to unlink it; an empty slot has
+  // no node.
+  struct Slot {
+    Node* node;
+    Node* prev;
+  };
+
+  // Owner of the nodes, shared with the views of the sequence. It is created
+  // with the first node, so empty and moved-from sequences own none. Nodes
+  // are only ever added at the end, so their ordinals grow along the list and
+  // a view is pinned by the ordinals of its first and last node.
+  struct Chain {
+    Node* head = nullptr;
+    uint64_t next_ordinal = 0;
+    // first and last ordinal of every live view, one entry per view
+    mutable vector<pair<uint64_t, uint64_t>> pins;
+
+    // whether a live view reaches the node
+    bool Pinned(const Node* node) const {
+      for (const pair<uint64_t, uint64_t>& pin : pins) {
+        if (pin.first <= node->get_ordinal() &&
+            node->get_ordinal() <= pin.second) {
+          return true;
+        }
+      }
+      return false;
+    }
+    ~Chain() {
+      while (head) {
+        Node* next = head->get_next();
+        delete head;
+        head = next;
+      }
+    }
   };
 
  private:
-  int length_;
-  Node* head;
+  int length_ = 0;
+  shared_ptr<Chain> chain_;
+  Node* tail_ = nullptr;
+  bool index_keys_;
+  vector<Slot> slots_;
+
+  Node* head() const { return chain_ ? chain_->head : nullptr; }
+  // Adds node at the end of the list without checking the key
+  void Append(Key key, Info info);
+  bool Contains(const Key& key);
+  // node holding key and the node before it, nullptr if there is none
+  Node* Find(const Key& key, Node*& prev) const;
+  void Swap(Sequence& sequence);
+  // slot the key hashes to
+  size_t IndexHome(const Key& key) const;
+  // slot holding key, or the empty slot where it would go
+  size_t IndexFind(const Key& key) const;
+  void IndexInsert(Node* node, Node* prev);
+  void IndexErase(size_t slot);
+  void IndexGrow();
 
  public:
-  Node* get_head() { return head; }
+  Node* get_head() { return head(); }
 };
 
+// Window of length consecutive nodes of a Sequence. It shares the nodes
+// instead of copying them: appending to the sequence never changes what a
+// view can reach, and the sequence copies its nodes before removing one that a
+// live view reaches. Converting a view to a Sequence copies the window, with
+// the key index setting of the sequence the view was taken from.
+template <typename Key, typename Info>
+class SequenceView {
+ public:
+  SequenceView() = default;
+  SequenceView(const SequenceView& view);
+  SequenceView(SequenceView&& view) noexcept { Swap(view); }
+  SequenceView& operator=(SequenceView view);
+  ~SequenceView();
+
+  int length() const { return length_; }
+  // Returns the part of the view from index to index+length-1, without
+  // copying it
+  SequenceView Trim(int index, const int length) const;
+  void Print() const;
+  // Writes every node in order, returns false if the sink failed
+  bool Export(Sink& sink, ExportFormat format = ExportFormat::kText) const;
+
+ private:
+  friend class Sequence<Key, Info>;
+  typedef typename Sequence<Key, Info>::Node Node;
+  typedef typename Sequence<Key, Info>::Chain Chain;
+
+  SequenceView(shared_ptr<const Chain> chain, Node* begin, uint64_t last,
+               int length, bool index_keys);
+  // registers the window with the chain, or unregisters it
+  void Pin();
+  void Unpin();
+  void Swap(SequenceView& view);
+
+  shared_ptr<const Chain> chain_;
+  Node* begin_ = nullptr;
+  uint64_t last_ = 0;  // ordinal of the last node
+  int length_ = 0;
+  bool index_keys_ = true;
+};
+
+// the benchmarks include this file with LINKED_LIST_NO_MAIN defined
+#ifndef LINKED_LIST_NO_MAIN
 int main() {
   Sequence<int, string> s1;
   s1.AddNode(0, "Jerzy");
@@ -106,63 +236,145 @@ int main() {
 
   return 0;
 }
+#endif  // LINKED_LIST_NO_MAIN
 
 template <typename Key, typename Info>
 Sequence<Key, Info> Sequence<Key, Info>::CombineSequences(
     Sequence& sequence1, int index1, const int length1, Sequence& sequence2,
     int index2, const int length2, int max_length) {
-  Sequence<Key, Info> combined_sequence =
-      sequence1.Trim(index1, length1) + sequence2.Trim(index2, length2);
-  combined_sequence = combined_sequence.Trim(0, max_length);
+  SequenceView<Key, Info> part1 = sequence1.Trim(index1, length1);
+  SequenceView<Key, Info> part2 = sequence2.Trim(index2, length2);
+  Sequence<Key, Info> combined_sequence;
+
+  if (max_length <= 0) {
+    Warning(
+        "Sequence::CombineSequences() Maximum length must be a positive "
+        "number, returning an empty list");
+    return combined_sequence;
+  }
+
+  // both parts in one pass, skipping duplicate keys and stopping at
+  // max_length
+  for (const SequenceView<Key, Info>* part : {&part1, &part2}) {
+    Node* curr = part->begin_;
+    for (int i = 0; i < part->length_ && combined_sequence.length_ < max_length;
+         i++) {
+      combined_sequence.AddNode(curr->get_key(), curr->get_info());
+      curr = curr->get_next();
+    }
+  }
+
+  if (!combined_sequence.length_)
+    Warning("Sequence::CombineSequences() Combined list is empty");
+
   return combined_sequence;
 }
 
 template <typename Key, typename Info>
-Sequence<Key, Info> Sequence<Key, Info>::Trim(int index,
-                                              const int length) const {
+SequenceView<Key, Info> Sequence<Key, Info>::Trim(int index,
+                                                  const int length) const {
+  return View().Trim(index, length);
+}
+
+template <typename Key, typename Info>
+SequenceView<Key, Info> SequenceView<Key, Info>::Trim(int index,
+                                                      const int length) const {
   if (index < 0) {
     Warning("Trim(): Index must be a nonnegative number, assuming 0.");
     index = 0;
   }
 
-  Sequence<Key, Info> trimmed_sequence;
-
   if (length <= 0) {
     Warning(
         "Trim(): Length must be a positive number, returning an empty list");
-    return trimmed_sequence;
+    return SequenceView();
   }
 
   if (index > length_) {
     Warning("Sequence::Trim() Index out of bounds, returning an empty list");
-    return trimmed_sequence;
+    return SequenceView();
   }
 
-  Node* curr = head;
-  int current_index = 0;
-  while (current_index < index) {
-    curr = curr->get_next();
-    current_index++;
+  int trimmed_length = min(length, length_ - index);
+  if (!trimmed_length) {
+    Warning("Sequence::Trim() Trimmed list is empty");
+    return SequenceView();
   }
 
-  Node* creator = nullptr;
-  Node* prev = nullptr;
+  Node* begin = begin_;
+  for (int current_index = 0; current_index < index; current_index++) {
+    begin = begin->get_next();
+  }
+  // the last node is only looked up when the window ends early
+  uint64_t last = last_;
+  if (index + trimmed_length < length_) {
+    Node* end = begin;
+    for (int i = 1; i < trimmed_length; i++) end = end->get_next();
+    last = end->get_ordinal();
+  }
+  return SequenceView(chain_, begin, last, trimmed_length, index_keys_);
+}
+
+template <typename Key, typename Info>
+SequenceView<Key, Info>::SequenceView(shared_ptr<const Chain> chain,
+                                      Node* begin, uint64_t last, int length,
+                                      bool index_keys)
+    : chain_(move(chain)),
+      begin_(begin),
+      last_(last),
+      length_(length),
+      index_keys_(index_keys) {
+  Pin();
+}
+
+template <typename Key, typename Info>
+SequenceView<Key, Info>::SequenceView(const SequenceView& view)
+    : chain_(view.chain_),
+      begin_(view.begin_),
+      last_(view.last_),
+      length_(view.length_),
+      index_keys_(view.index_keys_) {
+  Pin();
+}
+
+template <typename Key, typename Info>
+SequenceView<Key, Info>& SequenceView<Key, Info>::operator=(
+    SequenceView view) {
+  Swap(view);
+  return *this;
+}
+
+template <typename Key, typename Info>
+SequenceView<Key, Info>::~SequenceView() {
+  Unpin();
+}
 
-  while (curr && current_index < index + length && current_index <= length_) {
-    current_index++;
-    creator = new Node(curr->get_key(), curr->get_info());
-    if (!trimmed_sequence.head) {
-      trimmed_sequence.head = creator;
-    } else {
-      prev->set_next(creator);
+template <typename Key, typename Info>
+void SequenceView<Key, Info>::Pin() {
+  if (length_) chain_->pins.push_back({begin_->get_ordinal(), last_});
+}
+
+template <typename Key, typename Info>
+void SequenceView<Key, Info>::Unpin() {
+  if (!length_) return;
+  vector<pair<uint64_t, uint64_t>>& pins = chain_->pins;
+  // equal windows are interchangeable, so any matching entry will do
+  for (size_t i = 0; i < pins.size(); i++) {
+    if (pins[i].first == begin_->get_ordinal() && pins[i].second == last_) {
+      pins[i] = pins.back();
+      pins.pop_back();
+      return;
     }
-    prev = creator;
-    curr = curr->get_next();
   }
+}
 
-  if (!trimmed_sequence.head) Warning("Sequence::Trim() Trimmed list is empty");
-
-  return trimmed_sequence;
+template <typename Key, typename Info>
+void SequenceView<Key, Info>::Swap(SequenceView& view) {
+  swap(chain_, view.chain_);
+  swap(begin_, view.begin_);
+  swap(last_, view.last_);
+  swap(length_, view.length_);
+  swap(index_keys_, view.index_keys_);
 }
 
 template <typename Key, typename Info>
@@ -172,8 +384,7 @@ Sequence<Key, Info> Sequence<Key, Info>::operator+(
 
   Sequence cList = *this;
 
-  Node* curr = sequence.head;
-  Node* prev = 0;
+  Node* curr = sequence.head();
 
   if (curr != NULL) {
     bool reached_the_end = false;
@@ -184,7 +395,6 @@ Sequence<Key, Info> Sequence<Key, Info>::operator+(
       if (curr->get_next() == NULL) {
         reached_the_end = true;
       } else {
-        prev = curr;
         curr = curr->get_next();
       }
     }
@@ -194,115 +404,252 @@ Sequence<Key, Info> Sequence<Key, Info>::operator+(
 }
 
 template <typename Key, typename Info>
-Sequence<Key, Info>::Sequence() {
-  head = NULL;
+Sequence<Key, Info>::Sequence(bool index_keys)
+    : index_keys_(index_keys) {}
+
+template <typename Key, typename Info>
+Sequence<Key, Info>::Sequence(const Sequence& sequence)
+    : Sequence(sequence.index_keys_) {
+  // keys of a sequence are already unique
+  for (Node* curr = sequence.head(); curr; curr = curr->get_next()) {
+    Append(curr->get_key(), curr->get_info());
+  }
 }
 
 template <typename Key, typename Info>
-void Sequence<Key, Info>::AddNode(Key key, Info info) {
-  Node* curr = head;
-  Node* prev = 0;
+Sequence<Key, Info>::Sequence(Sequence&& sequence) noexcept
+    : Sequence(sequence.index_keys_) {
+  Swap(sequence);
+}
 
-  // if adding to an empty list
-  if (!curr) {
-    curr = new Node(key, info);
-    prev = curr;
-    head = curr;
+template <typename Key, typename Info>
+Sequence<Key, Info>::Sequence(const SequenceView<Key, Info>& view)
+    : Sequence(view.index_keys_) {
+  Node* curr = view.begin_;
+  for (int i = 0; i < view.length_; i++) {
+    Append(curr->get_key(), curr->get_info());
+    curr = curr->get_next();
+  }
+}
+
+template <typename Key, typename Info>
+Sequence<Key, Info>& Sequence<Key, Info>::operator=(Sequence sequence) {
+  Swap(sequence);
+  return *this;
+}
+
+template <typename Key, typename Info>
+void Sequence<Key, Info>::Swap(Sequence& sequence) {
+  swap(length_, sequence.length_);
+  swap(chain_, sequence.chain_);
+  swap(tail_, sequence.tail_);
+  swap(index_keys_, sequence.index_keys_);
+  swap(slots_, sequence.slots_);
+}
+
+template <typename Key, typename Info>
+void Sequence<Key, Info>::AddNode(const Key& key, const Info& info) {
+  if (Contains(key)) {
+    Warning(
+        "Sequence::AddNode(): Node not added. Node with the given data "
+        "already exists.");
+    return;
+  }
+  Append(key, info);
+}
+
+template <typename Key, typename Info>
+void Sequence<Key, Info>::Append(Key key, Info info) {
+  if (!chain_) chain_ = make_shared<Chain>();
+  Node* node = new Node(move(key), move(info), chain_->next_ordinal++);
+  Node* prev = tail_;
+  if (!chain_->head) {
+    chain_->head = node;
   } else {
-    // checking if node with given key exists, if not adding a new node at the
-    // end
-    bool reached_the_end = false;
+    tail_->set_next(node);
+  }
+  tail_ = node;
+  length_++;
+  if (index_keys_) IndexInsert(node, prev);
+}
 
-    while (!reached_the_end) {
-      if (curr->get_key() == key) {
-        Warning(
-            "Sequence::AddNode(): Node not added. Node with the given data "
-            "already exists.");
-        return;
-      }
+template <typename Key, typename Info>
+bool Sequence<Key, Info>::Contains(const Key& key) {
+  if (index_keys_) return slots_.size() && slots_[IndexFind(key)].node;
 
-      if (curr->get_next() == NULL) {
-        curr->set_next(new Node(key, info));
-        length_++;
-        reached_the_end = true;
-      } else {
-        prev = curr;
-        curr = curr->get_next();
-      }
-    }
+  for (Node* curr = head(); curr; curr = curr->get_next()) {
+    if (curr->get_key() == key) return true;
   }
+  return false;
 }
 
 template <typename Key, typename Info>
-void Sequence<Key, Info>::RemoveNode(Key key) {
-  if (head == NULL) {
+void Sequence<Key, Info>::RemoveNode(const Key& key) {
+  if (head() == NULL) {
     Warning(
         "Sequence::RemoveNode() Node not removed. Cannot remove a node from an "
         "empty list.");
     return;
   }
 
-  Node* curr = head;
-  Node* prev = 0;
+  Node* prev = nullptr;
+  Node* curr = Find(key, prev);
+  if (!curr) {
+    Warning(
+        "Sequence::RemoveNode() Node not removed. Node with the given key "
+        "does not exist.");
+    return;
+  }
 
-  bool reached_the_end = false;
+  // views reaching the node keep the shared nodes and the sequence carries on
+  // with a copy; nodes outside every view are unlinked in place
+  if (chain_->Pinned(curr)) {
+    *this = Sequence(*this);
+    curr = Find(key, prev);
+  }
+  if (index_keys_) IndexErase(IndexFind(key));
+
+  Node* next = curr->get_next();
+  if (!prev)
+    chain_->head = next;
+  else
+    prev->set_next(next);
+  if (curr == tail_) tail_ = prev;
+  // the next node's predecessor changed
+  if (next && index_keys_) slots_[IndexFind(next->get_key())].prev = prev;
+  delete curr;
+  length_--;
+}
 
-  while (!reached_the_end) {
-    if (curr->get_key() == key) {
-      if (!prev)
-        head = curr->get_next();
-      else
-        prev->set_next(curr->get_next());
-      return;
+template <typename Key, typename Info>
+typename Sequence<Key, Info>::Node* Sequence<Key, Info>::Find(
+    const Key& key, Node*& prev) const {
+  if (index_keys_) {
+    const Slot& slot = slots_[IndexFind(key)];
+    prev = slot.prev;
+    return slot.node;
+  }
+  prev = nullptr;
+  for (Node* curr = head(); curr; curr = curr->get_next()) {
+    if (curr->get_key() == key) return curr;
+    prev = curr;
+  }
+  return nullptr;
+}
+
+template <typename Key, typename Info>
+size_t Sequence<Key, Info>::IndexHome(const Key& key) const {
+  // mixing, so that consecutive integer keys don't form one long run
+  uint64_t mixed = hash<Key>()(key) * 0x9E3779B97F4A7C15ull;
+  return (mixed >> 16) & (slots_.size() - 1);
+}
+
+template <typename Key, typename Info>
+size_t Sequence<Key, Info>::IndexFind(const Key& key) const {
+  size_t mask = slots_.size() - 1;
+  size_t slot = IndexHome(key);
+  while (slots_[slot].node && !(slots_[slot].node->get_key() == key)) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+template <typename Key, typename Info>
+void Sequence<Key, Info>::IndexInsert(Node* node, Node* prev) {
+  // kept at most half full
+  if (2 * size_t(length_) > slots_.size()) IndexGrow();
+  slots_[IndexFind(node->get_key())] = {node, prev};
+}
+
+template <typename Key, typename Info>
+void Sequence<Key, Info>::IndexErase(size_t slot) {
+  // shifting later entries of the probe run back, so no run has a hole
+  size_t mask = slots_.size() - 1;
+  size_t hole = slot;
+  for (size_t next = (hole + 1) & mask; slots_[next].node;
+       next = (next + 1) & mask) {
+    size_t home = IndexHome(slots_[next].node->get_key());
+    // the entry can fill the hole unless its home lies between the hole and
+    // the entry
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      slots_[hole] = slots_[next];
+      hole = next;
     }
   }
+  slots_[hole] = {nullptr, nullptr};
+}
+
+template <typename Key, typename Info>
+void Sequence<Key, Info>::IndexGrow() {
+  vector<Slot> old_slots;
+  swap(old_slots, slots_);
+  slots_.assign(old_slots.empty() ? 16 : 2 * old_slots.size(),
+                Slot{nullptr, nullptr});
+  for (const Slot& entry : old_slots) {
+    if (entry.node) slots_[IndexFind(entry.node->get_key())] = entry;
+  }
 }
 
 template <typename Key, typename Info>
 void Sequence<Key, Info>::Print() {
-  if (head == NULL) {
+  View().Print();
+}
+
+template <typename Key, typename Info>
+bool Sequence<Key, Info>::Export(Sink& sink, ExportFormat format) const {
+  return View().Export(sink, format);
+}
+
+template <typename Key, typename Info>
+void SequenceView<Key, Info>::Print() const {
+  if (!length_) {
     Warning(
         "Sequence::Print() Sequence not printed. Cannot print an empty list.");
     return;
   }
 
-  Node* curr = head;
-
-  bool reached_the_end = false;
-
-  cout << "{";
-
-  while (!reached_the_end) {
-    curr->PrintNode();
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
+  writer.Append('{');
 
-    if (curr->get_next() == NULL) {
-      reached_the_end = true;
-    } else {
-      curr = curr->get_next();
-    }
-    if (!reached_the_end) cout << ", ";
+  Node* curr = begin_;
+  for (int i = 0; i < length_; i++) {
+    if (i) writer.Append(", ");
+    curr->PrintNode(writer);
+    curr = curr->get_next();
   }
-  cout << "}" << endl;
+  writer.Append("}\n");
 }
+
 template <typename Key, typename Info>
-void Sequence<Key, Info>::Node::PrintNode() {
-  cout << this->key << ": " << this->info;
+bool SequenceView<Key, Info>::Export(Sink& sink, ExportFormat format) const {
+  BufferedWriter writer(sink);
+  Node* curr = begin_;
+  for (int i = 0; i < length_; i++) {
+    writer.AppendRecord(curr->get_key(), curr->get_info(), format);
+    curr = curr->get_next();
+  }
+  return writer.Flush();
 }
 
 template <typename Key, typename Info>
-Sequence<Key, Info>::Node::Node(Key key, Info info) {
-  this->key = key;
-  this->info = info;
-  this->next = NULL;
+void Sequence<Key, Info>::Node::PrintNode(BufferedWriter& writer) {
+  writer.AppendText(this->key);
+  writer.Append(": ");
+  writer.AppendText(this->info);
 }
+
+template <typename Key, typename Info>
+Sequence<Key, Info>::Node::Node(Key key, Info info, uint64_t ordinal)
+    : key(move(key)), info(move(info)), next(NULL), ordinal(ordinal) {}
 template <typename Key, typename Info>
 void Sequence<Key, Info>::Node::set_info(Info info) {
-  this->info = info;
+  this->info = move(info);
 }
 
 template <typename Key, typename Info>
 void Sequence<Key, Info>::Node::set_key(Key key) {
-  this->key = key;
+  this->key = move(key);
 }
 
 template <typename Key, typename Info>
@@ -0,0 +1,78 @@
+// Benchmark of LruCache and ShardedLruCache on zipfian key traces (s = 0.99
+// over a million keys). Each access is a Get, followed by a Put on a miss,
+// the way a read-through cache is used. Reports time per access, hit rate and
+// evictions for several capacities, then the sharded cache on 1 to 8 threads.
+// Build: g++ -std=c++17 -O2 -pthread lru-bench.cpp
+// Usage: ./a.out [accesses]
+
+#define RING_NO_MAIN
+#include "ring.cpp"
+#include "bench.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+const size_t kKeys = 1000000;
+
+// keys with probability proportional to 1 / (rank + 1)^s, popular keys
+// scattered over the key space
+vector<uint64_t> ZipfianTrace(size_t accesses, double s, uint32_t seed) {
+  vector<double> cdf(kKeys);
+  double sum = 0;
+  for (size_t i = 0; i < kKeys; i++) cdf[i] = sum += 1 / pow(i + 1.0, s);
+  mt19937 random(seed);
+  uniform_real_distribution<double> uniform(0, sum);
+  vector<uint64_t> trace(accesses);
+  for (uint64_t& key : trace) {
+    size_t rank = lower_bound(cdf.begin(), cdf.end(), uniform(random)) -
+                  cdf.begin();
+    key = rank * 2654435761u % kKeys;
+  }
+  return trace;
+}
+
+template <typename Cache>
+void Replay(Cache& cache, const vector<uint64_t>& trace) {
+  uint64_t info;
+  for (uint64_t key : trace) {
+    if (!cache.Get(key, info)) cache.Put(key, key);
+  }
+}
+
+int main(int argc, char** argv) {
+  size_t accesses = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+  vector<uint64_t> trace = ZipfianTrace(accesses, 0.99, 42);
+  printf("%zu accesses over %zu keys\n", accesses, kKeys);
+
+  for (size_t capacity : {1000, 10000, 100000}) {
+    LruCache<uint64_t, uint64_t> cache(capacity);
+    double time = NanosecondsPerOp(accesses, [&] { Replay(cache, trace); });
+    printf("LruCache        capacity %6zu  %6.1f ns/access  hit rate %5.1f%%"
+           "  evictions %zu\n",
+           capacity, time, 100.0 * cache.hits() / accesses,
+           cache.evictions());
+  }
+
+  size_t capacity = 100000;
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    ShardedLruCache<uint64_t, uint64_t> cache(capacity);
+    vector<vector<uint64_t>> traces;
+    for (int t = 0; t < threads; t++) {
+      traces.push_back(ZipfianTrace(accesses / threads, 0.99, t));
+    }
+    double time = NanosecondsPerOp(accesses, [&] {
+      vector<thread> workers;
+      for (int t = 0; t < threads; t++) {
+        workers.emplace_back(
+            [&cache, &traces, t] { Replay(cache, traces[t]); });
+      }
+      for (thread& worker : workers) worker.join();
+    });
+    printf("ShardedLruCache capacity %6zu  %d thread(s)  %6.1f ns/access"
+           "  hit rate %5.1f%%\n",
+           capacity, threads, time,
+           100.0 * cache.hits() / (cache.hits() + cache.misses()));
+  }
+}
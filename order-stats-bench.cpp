@@ -0,0 +1,83 @@
+/** Benchmark of the order-statistic queries of Dictionary
+ Times insert and remove, which keep subtree sizes up to date, against
+ std::map, which has no sizes to maintain, and select/rank/countRange
+ against walking the tree in order as was needed before.
+ Build: g++ -std=c++17 -O2 -pthread order-stats-bench.cpp
+ Usage: ./a.out [n]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <map>
+#include <random>
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    mt19937 random(42);
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(i);
+    shuffle(keys.begin(), keys.end(), random);
+
+    Dictionary<int, int> dictionary;
+    map<int, int> reference;
+    double treeInsert = NanosecondsPerOp(n, [&] {
+        for (int key : keys)
+            dictionary.insert(key, key);
+    });
+    double mapInsert = NanosecondsPerOp(n, [&] {
+        for (int key : keys)
+            reference.emplace(key, key);
+    });
+    printf("insert      Dictionary %7.1f ns/op  std::map %7.1f ns/op  ratio %.2f\n", treeInsert, mapInsert, treeInsert / mapInsert);
+
+    // queries on a fraction of n, the in-order walks take O(n) each
+    size_t queries = max<size_t>(n / 10000, 10);
+    vector<size_t> positions(queries);
+    for (size_t& position : positions)
+        position = random() % n;
+    size_t checksum = 0;
+    double select = NanosecondsPerOp(queries, [&] {
+        for (size_t k : positions)
+            checksum += dictionary.select(k)->getKey();
+    });
+    double walk = NanosecondsPerOp(queries, [&] {
+        for (size_t k : positions)
+            checksum -= next(reference.begin(), k)->first;
+    });
+    printf("select      Dictionary %7.1f ns/op  in-order walk %10.1f ns/op\n", select, walk);
+    double rank = NanosecondsPerOp(queries, [&] {
+        for (size_t k : positions)
+            checksum += dictionary.rank(static_cast<int>(k));
+    });
+    walk = NanosecondsPerOp(queries, [&] {
+        for (size_t k : positions)
+            checksum -= distance(reference.begin(), reference.lower_bound(static_cast<int>(k)));
+    });
+    printf("rank        Dictionary %7.1f ns/op  in-order walk %10.1f ns/op\n", rank, walk);
+    double countRange = NanosecondsPerOp(queries, [&] {
+        for (size_t k : positions)
+            checksum += dictionary.countRange(static_cast<int>(k / 2), static_cast<int>(k));
+    });
+    walk = NanosecondsPerOp(queries, [&] {
+        for (size_t k : positions)
+            checksum -= distance(reference.lower_bound(static_cast<int>(k / 2)), reference.lower_bound(static_cast<int>(k)));
+    });
+    printf("countRange  Dictionary %7.1f ns/op  in-order walk %10.1f ns/op\n", countRange, walk);
+    if (checksum)
+        printf("queries disagree!\n");
+
+    shuffle(keys.begin(), keys.end(), random);
+    double treeRemove = NanosecondsPerOp(n, [&] {
+        for (int key : keys)
+            dictionary.remove(key);
+    });
+    double mapRemove = NanosecondsPerOp(n, [&] {
+        for (int key : keys)
+            reference.erase(key);
+    });
+    printf("remove      Dictionary %7.1f ns/op  std::map %7.1f ns/op  ratio %.2f\n", treeRemove, mapRemove, treeRemove / mapRemove);
+}
@@ -0,0 +1,87 @@
+// Throughput and hand-off latency benchmark of SpscRing and MpmcRing. Every
+// message carries the time it was pushed; consumers record the time from push
+// to pop, and the 99th percentile of those is reported with the rate of
+// messages per second. Threads yield when the ring is full or empty.
+// Build: g++ -std=c++17 -O2 -pthread queue-bench.cpp
+// Usage: ./a.out [messages] [capacity]
+
+#define RING_NO_MAIN
+#include "ring.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+uint64_t Now() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Result {
+  double messages_per_second;
+  uint64_t p99_nanoseconds;
+};
+
+template <typename Queue>
+Result Run(Queue& queue, int producers, int consumers, size_t messages) {
+  atomic<size_t> popped{0};
+  vector<vector<uint64_t>> latencies(consumers);
+  vector<thread> threads;
+  uint64_t start = Now();
+  for (int p = 0; p < producers; p++) {
+    size_t share = messages / producers + (p < int(messages % producers));
+    threads.emplace_back([&queue, share] {
+      for (size_t i = 0; i < share; i++) {
+        while (!queue.TryPush(Now(), i)) this_thread::yield();
+      }
+    });
+  }
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&queue, &popped, &latencies, c, messages] {
+      uint64_t pushed_at, payload;
+      while (popped.load(memory_order_relaxed) < messages) {
+        if (!queue.TryPop(pushed_at, payload)) {
+          this_thread::yield();
+          continue;
+        }
+        latencies[c].push_back(Now() - pushed_at);
+        popped.fetch_add(1, memory_order_relaxed);
+      }
+    });
+  }
+  for (thread& t : threads) t.join();
+  double seconds = (Now() - start) / 1e9;
+
+  vector<uint64_t> all;
+  for (const vector<uint64_t>& part : latencies) {
+    all.insert(all.end(), part.begin(), part.end());
+  }
+  auto p99 = all.begin() + all.size() * 99 / 100;
+  nth_element(all.begin(), p99, all.end());
+  return {messages / seconds, *p99};
+}
+
+void Report(const char* name, int producers, int consumers, Result result) {
+  printf("%-8s %d producer(s) %d consumer(s)  %7.2f M msgs/s  p99 %9.0f ns\n",
+         name, producers, consumers, result.messages_per_second / 1e6,
+         double(result.p99_nanoseconds));
+}
+
+int main(int argc, char** argv) {
+  size_t messages = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+  size_t capacity = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1024;
+  printf("%zu messages, capacity %zu, %u hardware threads\n", messages,
+         capacity, thread::hardware_concurrency());
+  {
+    SpscRing<uint64_t, uint64_t> queue(capacity);
+    Report("SpscRing", 1, 1, Run(queue, 1, 1, messages));
+  }
+  for (int producers : {1, 2, 4}) {
+    for (int consumers : {1, 2, 4}) {
+      MpmcRing<uint64_t, uint64_t> queue(capacity);
+      Report("MpmcRing", producers, consumers,
+             Run(queue, producers, consumers, messages));
+    }
+  }
+}
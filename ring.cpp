@@ -1,47 +1,96 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "buffered-writer.h"
 
 using namespace std;
 
 void Warning(string s);
 void Info(string s);
 
+// Layout of the rings' Print functions, "key: k, info:i" per line
+template <typename Key, typename Info>
+void AppendPrinted(BufferedWriter& writer, const Key& k, const Info& i) {
+  writer.Append("key: ");
+  writer.AppendText(k);
+  writer.Append(", info:");
+  writer.AppendText(i);
+  writer.Append('\n');
+}
+
 // Doubly linked ring with a sentinel node
 template <typename Key, typename Info>
 class Ring {
  private:
-  class Node {
+  // links only, so the sentinel carries no key or info
+  class NodeBase {
+   private:
+    NodeBase* next_;
+    NodeBase* prev_;
+
+   public:
+    NodeBase(NodeBase* next, NodeBase* prev) : next_(next), prev_(prev) {}
+    NodeBase* get_next() { return this->next_; }
+    void set_next(NodeBase* next_) { this->next_ = next_; }
+    NodeBase* get_prev() { return this->prev_; }
+    void set_prev(NodeBase* prev_) { this->prev_ = prev_; }
+  };
+
+  class Node : public NodeBase {
    private:
     Key key_;
     Info info_;
-    Node* next_;
-    Node* prev_;
 
    public:
-    Node(Key key, Info info, Node* next, Node* prev)
-        : key_(key), info_(info), next_(next), prev_(prev) {}
-    Node(Node* next, Node* prev) : next_(next), prev_(prev) {}
-    Info get_info() const { return this->info_; }
-    Key get_key() const { return this->key_; }
-    void set_key(const Key& key);
-    void set_info(const Info& info);
-    Node* get_next() { return this->next_; }
-    void set_next(Node* next_) { this->next_ = next_; }
-    Node* get_prev() { return this->prev_; }
-    void set_prev(Node* prev_) { this->prev_ = prev_; }
+    template <typename KeyArg, typename... InfoArgs>
+    Node(KeyArg&& key, InfoArgs&&... info)
+        : NodeBase(nullptr, nullptr),
+          key_(forward<KeyArg>(key)),
+          info_(forward<InfoArgs>(info)...) {}
+    Info& get_info() { return this->info_; }
+    Key& get_key() { return this->key_; }
+    void set_key(const Key& key) { this->key_ = key; }
+    void set_info(const Info& info) { this->info_ = info; }
   };
-  Node* head_;
+  // the sentinel lives inside the ring, so moving a ring only relinks the
+  // first and last nodes and never allocates
+  NodeBase sentinel_{&sentinel_, &sentinel_};
+  NodeBase* head_ = &sentinel_;
   int length_ = 0;
 
+  void Unlink(NodeBase* node);
+  // moves all nodes of the other ring into this empty one
+  void TakeNodes(Ring& other);
+  void Clear();
+
  public:
   template <typename K, typename I>
   class iterator {
    private:
     friend class Ring<Key, Info>;
-    Node* ptr_;
+    template <typename, typename>
+    friend class iterator;
+    NodeBase* ptr_;
 
    public:
     iterator() : ptr_(nullptr){};
-    iterator(Node* ptr) : ptr_(ptr){};
+    iterator(NodeBase* ptr) : ptr_(ptr){};
+    // an Iterator converts to a Const_Iterator, but not the other way
+    template <typename OtherK, typename OtherI,
+              typename = enable_if_t<is_const<K>::value &&
+                                     !is_const<OtherK>::value>>
+    iterator(const iterator<OtherK, OtherI>& it) : ptr_(it.ptr_){};
     iterator& operator++()  // pre incrementation
     {
       ptr_ = ptr_->get_next();
@@ -71,8 +120,8 @@ class Ring {
     bool operator==(const iterator& it) { return ptr_ == it.ptr_; }
     bool operator!=(const iterator& it) { return ptr_ != it.ptr_; }
 
-    K operator*() { return ptr_->get_key(); }
-    I get_info() { return ptr_->get_info(); }
+    K& operator*() { return static_cast<Node*>(ptr_)->get_key(); }
+    I& get_info() { return static_cast<Node*>(ptr_)->get_info(); }
   };
   typedef iterator<Key, Info> Iterator;
   typedef iterator<const Key, const Info> Const_Iterator;
@@ -87,13 +136,436 @@ class Ring {
   }
   Const_Iterator const_end() const { return Const_Iterator(head_); }
 
-  Ring();
+  Ring() = default;
+  Ring(const Ring& other);
+  // the moved-from ring is left empty
+  Ring(Ring&& other) noexcept { TakeNodes(other); }
+  Ring& operator=(Ring other);
+  ~Ring();
+
+  int length() const { return length_; }
+  void InsertAtEnd(const Key& k, const Info& i);
+  Iterator InsertAtFront(const Key& k, const Info& i);
+  void InsertAfter(NodeBase* new_node, NodeBase* old_node);
+  // the key is built from its argument and the info from the rest, in place
+  template <typename KeyArg, typename... InfoArgs>
+  Iterator EmplaceBack(KeyArg&& key, InfoArgs&&... info);
+  // emplacing after end() emplaces at the front
+  template <typename KeyArg, typename... InfoArgs>
+  Iterator EmplaceAfter(Iterator pos, KeyArg&& key, InfoArgs&&... info);
+  Iterator Find(const Key& k);
+  void SetInfo(Iterator it, const Info& i);
+  void MoveToFront(Iterator it);
+  // relinks the element at it from the other ring to the end of this one
+  void Transfer(Iterator it, Ring& from);
+  // The operations below relink nodes and never allocate or copy elements.
+  // moves [first, last) of the other ring before pos; counting the moved
+  // elements is linear unless the other ring is this one
+  void Splice(Iterator pos, Ring& other, Iterator first, Iterator last);
+  // element n becomes the first one; negative n rotates the other way
+  void Rotate(int n);
+  // this ring keeps the elements before it, the rest are returned
+  Ring SplitAt(Iterator it);
+  void Reverse();
+  void Erase(Iterator it);
+  // writes every element in order; returns false if the sink failed
+  bool Export(Sink& sink, ExportFormat format = ExportFormat::kText) const;
+  void Print() const;
+  void PrintReverse() const;
+};
+
+// Hierarchical timing wheel. Every level has kSlots rings, and a slot at level
+// L spans kSlots^L ticks. A timer sits at the level of the highest group of
+// bits in which its deadline differs from the current tick. When the current
+// tick reaches a slot's span, that slot is cascaded into the lower levels, so
+// the level and slot of a pending timer follow from its deadline. Schedule and
+// Cancel are O(1); each timer is cascaded at most once per level.
+class TimerWheel {
+ public:
+  typedef function<void()> Callback;
+  // stays valid until the timer fires or is cancelled
+  typedef Ring<uint64_t, Callback>::Iterator Handle;
+
+  explicit TimerWheel(uint64_t now = 0) : now_(now) {}
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  uint64_t now() const { return now_; }
+  size_t size() const { return size_; }
+
+  // deadlines that are not in the future fire on the next tick
+  Handle Schedule(uint64_t deadline, const Callback& callback);
+  void Cancel(Handle handle);
+  // fires every timer with a deadline up to now, in deadline order; returns
+  // how many fired
+  size_t Advance(uint64_t now);
+
+ private:
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlots = 1 << kSlotBits;
+  static constexpr int kLevels = (64 + kSlotBits - 1) / kSlotBits;
+
+  Ring<uint64_t, Callback> slots_[kLevels][kSlots];
+  size_t level_size_[kLevels] = {};
+  uint64_t now_;
+  size_t size_ = 0;
+
+  int LevelOf(uint64_t deadline) const;
+  Ring<uint64_t, Callback>& SlotOf(uint64_t deadline, int level) {
+    return slots_[level][(deadline >> (level * kSlotBits)) & (kSlots - 1)];
+  }
+  void Cascade(int level);
+  size_t Fire();
+};
+
+// Ring of at most capacity elements ordered from most to least recently used.
+// A hash index from key to ring position makes lookups O(1); a lookup moves
+// the element to the front and an insert into a full cache evicts the back.
+template <typename Key, typename Info>
+class LruCache {
+ private:
+  typedef typename Ring<Key, Info>::Iterator Position;
+
+  Ring<Key, Info> ring_;
+  unordered_map<Key, Position> index_;
+  size_t capacity_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  size_t evictions_ = 0;
+
+ public:
+  explicit LruCache(size_t capacity) : capacity_(capacity) {}
+  LruCache(const LruCache&) = delete;
+  LruCache& operator=(const LruCache&) = delete;
+
+  size_t size() const { return index_.size(); }
+  size_t capacity() const { return capacity_; }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  size_t evictions() const { return evictions_; }
+
+  bool Get(const Key& k, Info& i);
+  void Put(const Key& k, const Info& i);
+  bool Remove(const Key& k);
+  void Print() const { ring_.Print(); }
+};
+
+// LruCache split into independently locked shards by key hash, for use from
+// several threads. Each shard holds an equal part of the capacity, so
+// eviction is least recently used within a shard.
+template <typename Key, typename Info>
+class ShardedLruCache {
+ private:
+  struct alignas(64) Shard {
+    mutex lock;
+    LruCache<Key, Info> cache;
+    explicit Shard(size_t capacity) : cache(capacity) {}
+  };
+  vector<unique_ptr<Shard>> shards_;
+
+  Shard& ShardFor(const Key& k) {
+    return *shards_[hash<Key>()(k) % shards_.size()];
+  }
+
+ public:
+  ShardedLruCache(size_t capacity, size_t shards = 16);
+
+  bool Get(const Key& k, Info& i);
+  void Put(const Key& k, const Info& i);
+  bool Remove(const Key& k);
+  size_t size();
+  size_t hits();
+  size_t misses();
+  size_t evictions();
+};
+
+// Ring kept in one array, for FIFO-style use. The capacity is a power of two,
+// so a position wraps around with a mask instead of a division, and doubles
+// when the array is full. The arrays are raw storage: elements are built in
+// place when inserted and destroyed when removed, so free slots hold nothing
+// and Key and Info need not be default constructible. Iterators behave like
+// Ring's: one past the last element is a sentinel position, ++end() is
+// begin() and --begin() is end().
+template <typename Key, typename Info>
+class ArrayRing {
+ private:
+  Key* keys_ = nullptr;
+  Info* infos_ = nullptr;
+  size_t capacity_ = 0;  // zero or a power of two
+  size_t head_ = 0;      // slot of the first element
+  size_t length_ = 0;
+
+  size_t Slot(size_t index) const { return (head_ + index) & (capacity_ - 1); }
+  void Grow();
+  // destroys the elements and frees the arrays
+  void Release();
+
+ public:
+  template <typename K, typename I>
+  class iterator {
+   private:
+    friend class ArrayRing<Key, Info>;
+    const ArrayRing* ring_;
+    size_t index_;  // ring_->length_ for the sentinel
+
+   public:
+    iterator() : ring_(nullptr), index_(0){};
+    iterator(const ArrayRing* ring, size_t index)
+        : ring_(ring), index_(index){};
+    iterator& operator++()  // pre incrementation
+    {
+      index_ = index_ == ring_->length_ ? 0 : index_ + 1;
+      return *this;
+    }
+
+    iterator operator++(int)  // post incrementation
+    {
+      iterator before = *this;
+      ++*this;
+      return before;
+    }
+
+    iterator& operator--()  // pre decrementation
+    {
+      index_ = index_ == 0 ? ring_->length_ : index_ - 1;
+      return *this;
+    }
+
+    iterator operator--(int)  // post decrementation
+    {
+      iterator before = *this;
+      --*this;
+      return before;
+    }
+
+    bool operator==(const iterator& it) { return index_ == it.index_; }
+    bool operator!=(const iterator& it) { return index_ != it.index_; }
+
+    K& operator*() { return ring_->keys_[ring_->Slot(index_)]; }
+    I& get_info() { return ring_->infos_[ring_->Slot(index_)]; }
+  };
+  typedef iterator<Key, Info> Iterator;
+  typedef iterator<const Key, const Info> Const_Iterator;
+
+  Iterator begin() { return Iterator(this, 0); }
+  Iterator end() { return Iterator(this, length_); }
+
+  Const_Iterator const_begin() const { return Const_Iterator(this, 0); }
+  Const_Iterator const_end() const { return Const_Iterator(this, length_); }
+
+  ArrayRing() = default;
+  explicit ArrayRing(size_t capacity);
+  ArrayRing(const ArrayRing& other);
+  ArrayRing(ArrayRing&& other) noexcept;
+  ArrayRing& operator=(ArrayRing other);
+  ~ArrayRing();
+
+  size_t length() const { return length_; }
+  size_t capacity() const { return capacity_; }
+
+  void InsertAtEnd(const Key& k, const Info& i);
+  void RemoveFirst();
+  void Print() const;
+  void PrintReverse() const;
+};
+
+// Ring that packs up to K elements into each node, keys and infos in separate
+// arrays, so the links and the allocation are paid once per K elements. Nodes
+// are split when an insert finds them full and merged with their successor
+// when an erase leaves them less than a quarter full. As in ArrayRing, the
+// arrays are raw storage and only the first count slots of a node hold
+// elements. Iterators behave like Ring's; an iterator is invalidated by any
+// insert or erase.
+template <typename Key, typename Info, int K = 16>
+class UnrolledRing {
+ private:
+  static_assert(K >= 2, "UnrolledRing needs room for two elements per node");
+
+  // links only, so the sentinel carries no elements
+  struct ChunkBase {
+    int count;
+    ChunkBase* next;
+    ChunkBase* prev;
+  };
+  struct Chunk : ChunkBase {
+    alignas(Key) unsigned char key_storage[K * sizeof(Key)];
+    alignas(Info) unsigned char info_storage[K * sizeof(Info)];
+
+    Key* keys() { return reinterpret_cast<Key*>(key_storage); }
+    Info* infos() { return reinterpret_cast<Info*>(info_storage); }
+  };
+  // the sentinel lives inside the ring, so moving a ring only relinks the
+  // first and last chunks and never allocates
+  ChunkBase sentinel_{0, &sentinel_, &sentinel_};
+  ChunkBase* head_ = &sentinel_;
+  int length_ = 0;
+
+  static Chunk* AsChunk(ChunkBase* chunk) { return static_cast<Chunk*>(chunk); }
+  // builds slot j of to from slot i of from, then destroys slot i
+  static void Relocate(Chunk* from, int i, Chunk* to, int j);
+  Chunk* NewChunkAfter(ChunkBase* chunk);
+  // destroys the elements of the chunk and frees it
+  void DeleteChunk(ChunkBase* chunk);
+  void Split(Chunk* chunk);
+  // moves all chunks of the other ring into this empty one
+  void TakeChunks(UnrolledRing& other);
+
+ public:
+  template <typename K_, typename I>
+  class iterator {
+   private:
+    friend class UnrolledRing<Key, Info, K>;
+    ChunkBase* chunk_;
+    int index_;
+
+   public:
+    iterator() : chunk_(nullptr), index_(0){};
+    iterator(ChunkBase* chunk, int index) : chunk_(chunk), index_(index){};
+    iterator& operator++()  // pre incrementation
+    {
+      if (++index_ >= chunk_->count) {
+        chunk_ = chunk_->next;
+        index_ = 0;
+      }
+      return *this;
+    }
+
+    iterator operator++(int)  // post incrementation
+    {
+      iterator before = *this;
+      ++*this;
+      return before;
+    }
+
+    iterator& operator--()  // pre decrementation
+    {
+      if (index_ == 0) {
+        chunk_ = chunk_->prev;
+        index_ = chunk_->count ? chunk_->count : 1;
+      }
+      index_--;
+      return *this;
+    }
+
+    iterator operator--(int)  // post decrementation
+    {
+      iterator before = *this;
+      --*this;
+      return before;
+    }
+
+    bool operator==(const iterator& it) {
+      return chunk_ == it.chunk_ && index_ == it.index_;
+    }
+    bool operator!=(const iterator& it) { return !(*this == it); }
+
+    K_& operator*() { return AsChunk(chunk_)->keys()[index_]; }
+    I& get_info() { return AsChunk(chunk_)->infos()[index_]; }
+  };
+  typedef iterator<Key, Info> Iterator;
+  typedef iterator<const Key, const Info> Const_Iterator;
+
+  Iterator begin() { return Iterator(head_->next, 0); }
+  Iterator end() { return Iterator(head_, 0); }
+
+  Const_Iterator const_begin() const { return Const_Iterator(head_->next, 0); }
+  Const_Iterator const_end() const { return Const_Iterator(head_, 0); }
+
+  UnrolledRing() = default;
+  UnrolledRing(const UnrolledRing& other);
+  // the moved-from ring is left empty
+  UnrolledRing(UnrolledRing&& other) noexcept { TakeChunks(other); }
+  UnrolledRing& operator=(UnrolledRing other);
+  ~UnrolledRing();
+
+  int length() const { return length_; }
+
   void InsertAtEnd(const Key& k, const Info& i);
-  void InsertAfter(Node* new_node, Node* old_node);
+  // inserting after end() inserts at the front
+  Iterator InsertAfter(Iterator pos, const Key& k, const Info& i);
+  // returns the element that followed the erased one
+  Iterator Erase(Iterator it);
+  Iterator Find(const Key& k);
   void Print() const;
   void PrintReverse() const;
 };
 
+// Bounded ring for handing elements from one producer thread to one consumer
+// thread without a lock. Each index is written by one side only and sits on
+// its own cache line; each side also caches the other side's index and only
+// reloads it when the ring looks full or empty. As in ArrayRing, the arrays
+// are raw storage: a push builds the element in place and a pop destroys it.
+template <typename Key, typename Info>
+class SpscRing {
+ private:
+  static constexpr size_t kCacheLine = 64;
+
+  Key* keys_;
+  Info* infos_;
+  size_t mask_;
+
+  alignas(kCacheLine) atomic<size_t> tail_{0};  // written by the producer
+  size_t cached_head_ = 0;
+  alignas(kCacheLine) atomic<size_t> head_{0};  // written by the consumer
+  size_t cached_tail_ = 0;
+
+ public:
+  explicit SpscRing(size_t capacity);
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+  ~SpscRing();
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // producer side
+  bool TryPush(const Key& k, const Info& i);
+  size_t PushN(const Key* keys, const Info* infos, size_t n);
+  // consumer side
+  bool TryPop(Key& k, Info& i);
+  size_t PopN(Key* keys, Info* infos, size_t n);
+};
+
+// Bounded ring for any number of producers and consumers (Vyukov's queue).
+// Every slot carries a sequence number that tells whether it is ready to be
+// written or read in the current lap, so threads only contend on claiming a
+// position. A slot holds an element only between the push and the pop that
+// claim it.
+template <typename Key, typename Info>
+class MpmcRing {
+ private:
+  static constexpr size_t kCacheLine = 64;
+
+  struct Slot {
+    atomic<size_t> sequence;
+    alignas(Key) unsigned char key_storage[sizeof(Key)];
+    alignas(Info) unsigned char info_storage[sizeof(Info)];
+
+    Key* key() { return reinterpret_cast<Key*>(key_storage); }
+    Info* info() { return reinterpret_cast<Info*>(info_storage); }
+  };
+
+  Slot* slots_;
+  size_t mask_;
+
+  alignas(kCacheLine) atomic<size_t> tail_{0};
+  alignas(kCacheLine) atomic<size_t> head_{0};
+
+ public:
+  explicit MpmcRing(size_t capacity);
+  MpmcRing(const MpmcRing&) = delete;
+  MpmcRing& operator=(const MpmcRing&) = delete;
+  ~MpmcRing();
+
+  size_t capacity() const { return mask_ + 1; }
+
+  bool TryPush(const Key& k, const Info& i);
+  size_t PushN(const Key* keys, const Info* infos, size_t n);
+  bool TryPop(Key& k, Info& i);
+  size_t PopN(Key* keys, Info* infos, size_t n);
+};
+
+// the benchmarks include this file with RING_NO_MAIN defined
+#ifndef RING_NO_MAIN
 int main() {
   Ring<int, int> s1;
   s1.InsertAtEnd(1, 10);
@@ -123,23 +595,142 @@ int main() {
   Ring<string, string> s3;
   Info("Attempting to print empty ring");
   s3.Print();
+
+  ArrayRing<int, int> queue;
+  for (int i = 1; i <= 10; i++) queue.InsertAtEnd(i, i * 10);
+  for (int i = 0; i < 7; i++) queue.RemoveFirst();
+  for (int i = 11; i <= 14; i++) queue.InsertAtEnd(i, i * 10);
+  Info("Printing array ring after wrapping around:");
+  queue.Print();
+
+  SpscRing<int, int> handoff(16);
+  thread producer([&handoff] {
+    for (int i = 1; i <= 1000; i++) {
+      while (!handoff.TryPush(i, i * 2)) this_thread::yield();
+    }
+  });
+  long sum = 0;
+  for (int received = 0, k, i; received < 1000;) {
+    if (handoff.TryPop(k, i)) {
+      sum += i;
+      received++;
+    } else {
+      this_thread::yield();
+    }
+  }
+  producer.join();
+  Info("Sum of infos handed off through spsc ring: " + to_string(sum));
+
+  MpmcRing<int, int> shared(8);
+  int keys[5] = {1, 2, 3, 4, 5}, infos[5] = {10, 20, 30, 40, 50};
+  size_t pushed = shared.PushN(keys, infos, 5);
+  pushed += shared.PushN(keys, infos, 5);
+  Info("Pushed " + to_string(pushed) + " of 10 into mpmc ring of 8");
+  shared.PopN(keys, infos, 5);
+  shared.PopN(keys, infos, 5);
+  Info("Last popped key: " + to_string(keys[2]));
+
+  UnrolledRing<int, int, 4> packed;
+  for (int i = 1; i <= 6; i++) packed.InsertAtEnd(i, i * 10);
+  packed.InsertAfter(packed.Find(2), 25, 250);
+  packed.Erase(packed.Find(5));
+  Info("Printing unrolled ring in reverse:");
+  packed.PrintReverse();
+
+  Ring<int, int> work;
+  for (int i = 1; i <= 6; i++) work.InsertAtEnd(i, i * 100);
+  work.Rotate(2);
+  work.Reverse();
+  Ring<int, int> tail = work.SplitAt(work.Find(6));
+  work.Splice(work.begin(), tail, tail.begin(), tail.end());
+  Info("Printing ring after rotate, reverse, split and splice:");
+  work.Print();
+  MemorySink csv;
+  work.Export(csv, ExportFormat::kCsv);
+  Info("Exported ring as csv: " + to_string(csv.data().size()) + " bytes");
+
+  TimerWheel wheel;
+  vector<string> fired;
+  wheel.Schedule(5, [&fired] { fired.push_back("5"); });
+  TimerWheel::Handle late =
+      wheel.Schedule(300, [&fired] { fired.push_back("300"); });
+  wheel.Schedule(70, [&fired] { fired.push_back("70"); });
+  wheel.Cancel(late);
+  size_t count = wheel.Advance(1000);
+  Info("Timer wheel fired " + to_string(count) + " timers, last at tick " +
+       fired.back());
+
+  LruCache<int, string> cache(3);
+  cache.Put(1, "one");
+  cache.Put(2, "two");
+  cache.Put(3, "three");
+  string word;
+  cache.Get(1, word);
+  cache.Put(4, "four");
+  if (!cache.Get(2, word)) Info("Key 2 was evicted from lru cache");
+  Info("Printing lru cache from most recently used:");
+  cache.Print();
+  Info("Hits " + to_string(cache.hits()) + ", misses " +
+       to_string(cache.misses()) + ", evictions " +
+       to_string(cache.evictions()));
+}
+#endif  // RING_NO_MAIN
+
+template <typename Key, typename Info>
+Ring<Key, Info>::Ring(const Ring& other) {
+  Const_Iterator it;
+  for (it = other.const_begin(); it != other.const_end(); it++) {
+    InsertAtEnd(*it, it.get_info());
+  }
+}
+
+template <typename Key, typename Info>
+Ring<Key, Info>& Ring<Key, Info>::operator=(Ring other) {
+  Clear();
+  TakeNodes(other);
+  return *this;
+}
+
+template <typename Key, typename Info>
+Ring<Key, Info>::~Ring() {
+  Clear();
 }
 
 template <typename Key, typename Info>
-Ring<Key, Info>::Ring() {
-  // creating sentinel node
-  head_ = new Node(nullptr, nullptr);
+void Ring<Key, Info>::TakeNodes(Ring& other) {
+  if (!other.length_) return;
+  NodeBase* first = other.head_->get_next();
+  NodeBase* last = other.head_->get_prev();
+  head_->set_next(first);
+  first->set_prev(head_);
+  head_->set_prev(last);
+  last->set_next(head_);
+  length_ = other.length_;
+  other.head_->set_next(other.head_);
+  other.head_->set_prev(other.head_);
+  other.length_ = 0;
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Clear() {
+  NodeBase* node = head_->get_next();
+  while (node != head_) {
+    NodeBase* next = node->get_next();
+    delete static_cast<Node*>(node);
+    node = next;
+  }
   head_->set_next(head_);
   head_->set_prev(head_);
+  length_ = 0;
 }
 
 template <typename Key, typename Info>
 void Ring<Key, Info>::InsertAtEnd(const Key& k, const Info& i) {
-  InsertAfter(new Node(k, i, head_, head_->get_prev()), head_->get_prev());
+  EmplaceBack(k, i);
 }
 
 template <typename Key, typename Info>
-void Ring<Key, Info>::InsertAfter(Node* new_node, Node* old_node) {
+void Ring<Key, Info>::InsertAfter(NodeBase* new_node, NodeBase* old_node) {
   new_node->set_next(old_node->get_next());
   new_node->set_prev(old_node);
   old_node->get_next()->set_prev(new_node);
@@ -147,13 +738,170 @@ void Ring<Key, Info>::InsertAfter(Node* new_node, Node* old_node) {
   length_++;
 }
 
+template <typename Key, typename Info>
+typename Ring<Key, Info>::Iterator Ring<Key, Info>::InsertAtFront(
+    const Key& k, const Info& i) {
+  return EmplaceAfter(end(), k, i);
+}
+
+template <typename Key, typename Info>
+template <typename KeyArg, typename... InfoArgs>
+typename Ring<Key, Info>::Iterator Ring<Key, Info>::EmplaceBack(
+    KeyArg&& key, InfoArgs&&... info) {
+  return EmplaceAfter(--end(), forward<KeyArg>(key),
+                      forward<InfoArgs>(info)...);
+}
+
+template <typename Key, typename Info>
+template <typename KeyArg, typename... InfoArgs>
+typename Ring<Key, Info>::Iterator Ring<Key, Info>::EmplaceAfter(
+    Iterator pos, KeyArg&& key, InfoArgs&&... info) {
+  Node* node = new Node(forward<KeyArg>(key), forward<InfoArgs>(info)...);
+  InsertAfter(node, pos.ptr_);
+  return Iterator(node);
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Unlink(NodeBase* node) {
+  node->get_prev()->set_next(node->get_next());
+  node->get_next()->set_prev(node->get_prev());
+  length_--;
+}
+
+template <typename Key, typename Info>
+typename Ring<Key, Info>::Iterator Ring<Key, Info>::Find(const Key& k) {
+  Iterator it;
+  for (it = begin(); it != end(); it++) {
+    if (*it == k) break;
+  }
+  return it;
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::SetInfo(Iterator it, const Info& i) {
+  if (it.ptr_ == head_) {
+    Warning("Ring::SetInfo() Cannot set info of the sentinel");
+    return;
+  }
+  static_cast<Node*>(it.ptr_)->set_info(i);
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::MoveToFront(Iterator it) {
+  if (it.ptr_ == head_) {
+    Warning("Ring::MoveToFront() Cannot move the sentinel");
+    return;
+  }
+  if (it.ptr_ == head_->get_next()) return;
+  Unlink(it.ptr_);
+  InsertAfter(it.ptr_, head_);
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Transfer(Iterator it, Ring& from) {
+  if (it.ptr_ == from.head_) {
+    Warning("Ring::Transfer() Cannot transfer the sentinel");
+    return;
+  }
+  from.Unlink(it.ptr_);
+  InsertAfter(it.ptr_, head_->get_prev());
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Splice(Iterator pos, Ring& other, Iterator first,
+                             Iterator last) {
+  if (first == last) return;
+  if (&other != this) {
+    int moved = 0;
+    for (Iterator it = first; it != last; it++) {
+      if (it.ptr_ == other.head_) {
+        Warning("Ring::Splice() Range contains the sentinel");
+        return;
+      }
+      moved++;
+    }
+    other.length_ -= moved;
+    length_ += moved;
+  }
+  NodeBase* first_node = first.ptr_;
+  NodeBase* last_node = last.ptr_->get_prev();
+  // cut [first, last) out of the other ring
+  first_node->get_prev()->set_next(last.ptr_);
+  last.ptr_->set_prev(first_node->get_prev());
+  // and link it in before pos
+  NodeBase* before = pos.ptr_->get_prev();
+  before->set_next(first_node);
+  first_node->set_prev(before);
+  last_node->set_next(pos.ptr_);
+  pos.ptr_->set_prev(last_node);
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Rotate(int n) {
+  if (!length_) return;
+  n %= length_;
+  if (n < 0) n += length_;
+  if (!n) return;
+  // the sentinel moves to just before the new first element, walking
+  // whichever way around the ring is shorter
+  NodeBase* first = head_;
+  if (n <= length_ / 2) {
+    for (int j = 0; j < n; j++) first = first->get_next();
+    first = first->get_next();
+  } else {
+    for (int j = 0; j < length_ - n; j++) first = first->get_prev();
+  }
+  Unlink(head_);
+  InsertAfter(head_, first->get_prev());
+}
+
+template <typename Key, typename Info>
+Ring<Key, Info> Ring<Key, Info>::SplitAt(Iterator it) {
+  Ring rest;
+  rest.Splice(rest.end(), *this, it, end());
+  return rest;
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Reverse() {
+  NodeBase* node = head_;
+  do {
+    NodeBase* next = node->get_next();
+    node->set_next(node->get_prev());
+    node->set_prev(next);
+    node = next;
+  } while (node != head_);
+}
+
+template <typename Key, typename Info>
+void Ring<Key, Info>::Erase(Iterator it) {
+  if (it.ptr_ == head_) {
+    Warning("Ring::Erase() Cannot erase the sentinel");
+    return;
+  }
+  Unlink(it.ptr_);
+  delete static_cast<Node*>(it.ptr_);
+}
+
+template <typename Key, typename Info>
+bool Ring<Key, Info>::Export(Sink& sink, ExportFormat format) const {
+  BufferedWriter writer(sink);
+  Const_Iterator it;
+  for (it = this->const_begin(); it != this->const_end(); it++) {
+    writer.AppendRecord(*it, it.get_info(), format);
+  }
+  return writer.Flush();
+}
+
 template <typename Key, typename Info>
 void Ring<Key, Info>::Print() const {
   if (!this->length_) Warning("Ring is empty");
 
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
   Const_Iterator it;
   for (it = this->const_begin(); it != this->const_end(); it++) {
-    cout << "key: " << *it << ", info:" << it.get_info() << endl;
+    AppendPrinted(writer, *it, it.get_info());
   };
 }
 
@@ -161,12 +909,669 @@ template <typename Key, typename Info>
 void Ring<Key, Info>::PrintReverse() const {
   if (!this->length_) Warning("Ring is empty");
 
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
   Const_Iterator it;
   for (it = --this->const_end(); it != this->const_end(); it--) {
-    cout << "key: " << *it << ", info:" << it.get_info() << endl;
+    AppendPrinted(writer, *it, it.get_info());
   };
 }
 
+template <typename Key, typename Info>
+ArrayRing<Key, Info>::ArrayRing(size_t capacity) {
+  if (capacity == 0) return;
+  capacity_ = 1;
+  while (capacity_ < capacity) capacity_ *= 2;
+  keys_ = allocator<Key>().allocate(capacity_);
+  infos_ = allocator<Info>().allocate(capacity_);
+}
+
+template <typename Key, typename Info>
+ArrayRing<Key, Info>::ArrayRing(const ArrayRing& other)
+    : ArrayRing(other.length_) {
+  // length_ counts the copies so far, which the destructor destroys if one
+  // throws
+  for (; length_ < other.length_; length_++) {
+    new (&keys_[length_]) Key(other.keys_[other.Slot(length_)]);
+    new (&infos_[length_]) Info(other.infos_[other.Slot(length_)]);
+  }
+}
+
+template <typename Key, typename Info>
+ArrayRing<Key, Info>::ArrayRing(ArrayRing&& other) noexcept
+    : keys_(other.keys_),
+      infos_(other.infos_),
+      capacity_(other.capacity_),
+      head_(other.head_),
+      length_(other.length_) {
+  other.keys_ = nullptr;
+  other.infos_ = nullptr;
+  other.capacity_ = other.head_ = other.length_ = 0;
+}
+
+template <typename Key, typename Info>
+ArrayRing<Key, Info>& ArrayRing<Key, Info>::operator=(ArrayRing other) {
+  swap(keys_, other.keys_);
+  swap(infos_, other.infos_);
+  swap(capacity_, other.capacity_);
+  swap(head_, other.head_);
+  swap(length_, other.length_);
+  return *this;
+}
+
+template <typename Key, typename Info>
+ArrayRing<Key, Info>::~ArrayRing() {
+  Release();
+}
+
+template <typename Key, typename Info>
+void ArrayRing<Key, Info>::Release() {
+  for (size_t i = 0; i < length_; i++) {
+    keys_[Slot(i)].~Key();
+    infos_[Slot(i)].~Info();
+  }
+  if (capacity_) {
+    allocator<Key>().deallocate(keys_, capacity_);
+    allocator<Info>().deallocate(infos_, capacity_);
+  }
+}
+
+template <typename Key, typename Info>
+void ArrayRing<Key, Info>::Grow() {
+  // elements are moved to the start of the new arrays in ring order
+  size_t capacity = capacity_ ? capacity_ * 2 : 8;
+  Key* keys = allocator<Key>().allocate(capacity);
+  Info* infos = allocator<Info>().allocate(capacity);
+  for (size_t i = 0; i < length_; i++) {
+    new (&keys[i]) Key(move(keys_[Slot(i)]));
+    new (&infos[i]) Info(move(infos_[Slot(i)]));
+  }
+  Release();
+  keys_ = keys;
+  infos_ = infos;
+  capacity_ = capacity;
+  head_ = 0;
+}
+
+template <typename Key, typename Info>
+void ArrayRing<Key, Info>::InsertAtEnd(const Key& k, const Info& i) {
+  if (length_ == capacity_) Grow();
+  new (&keys_[Slot(length_)]) Key(k);
+  new (&infos_[Slot(length_)]) Info(i);
+  length_++;
+}
+
+template <typename Key, typename Info>
+void ArrayRing<Key, Info>::RemoveFirst() {
+  if (!length_) {
+    Warning("ArrayRing::RemoveFirst() Ring is empty");
+    return;
+  }
+  keys_[head_].~Key();
+  infos_[head_].~Info();
+  head_ = Slot(1);
+  length_--;
+}
+
+template <typename Key, typename Info>
+void ArrayRing<Key, Info>::Print() const {
+  if (!this->length_) Warning("Ring is empty");
+
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
+  for (size_t i = 0; i < length_; i++) {
+    AppendPrinted(writer, keys_[Slot(i)], infos_[Slot(i)]);
+  }
+}
+
+template <typename Key, typename Info>
+void ArrayRing<Key, Info>::PrintReverse() const {
+  if (!this->length_) Warning("Ring is empty");
+
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
+  for (size_t i = length_; i-- > 0;) {
+    AppendPrinted(writer, keys_[Slot(i)], infos_[Slot(i)]);
+  }
+}
+
+template <typename Key, typename Info, int K>
+UnrolledRing<Key, Info, K>::UnrolledRing(const UnrolledRing& other) {
+  // copies are packed full
+  for (ChunkBase* base = other.head_->next; base != other.head_;
+       base = base->next) {
+    Chunk* chunk = AsChunk(base);
+    for (int j = 0; j < chunk->count; j++) {
+      InsertAtEnd(chunk->keys()[j], chunk->infos()[j]);
+    }
+  }
+}
+
+template <typename Key, typename Info, int K>
+UnrolledRing<Key, Info, K>& UnrolledRing<Key, Info, K>::operator=(
+    UnrolledRing other) {
+  while (head_->next != head_) DeleteChunk(head_->next);
+  length_ = 0;
+  TakeChunks(other);
+  return *this;
+}
+
+template <typename Key, typename Info, int K>
+UnrolledRing<Key, Info, K>::~UnrolledRing() {
+  while (head_->next != head_) DeleteChunk(head_->next);
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::TakeChunks(UnrolledRing& other) {
+  if (other.head_->next == other.head_) return;
+  ChunkBase* first = other.head_->next;
+  ChunkBase* last = other.head_->prev;
+  head_->next = first;
+  first->prev = head_;
+  head_->prev = last;
+  last->next = head_;
+  length_ = other.length_;
+  other.head_->next = other.head_;
+  other.head_->prev = other.head_;
+  other.length_ = 0;
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::Relocate(Chunk* from, int i, Chunk* to,
+                                          int j) {
+  new (&to->keys()[j]) Key(move(from->keys()[i]));
+  new (&to->infos()[j]) Info(move(from->infos()[i]));
+  from->keys()[i].~Key();
+  from->infos()[i].~Info();
+}
+
+template <typename Key, typename Info, int K>
+typename UnrolledRing<Key, Info, K>::Chunk*
+UnrolledRing<Key, Info, K>::NewChunkAfter(ChunkBase* chunk) {
+  Chunk* added = new Chunk;
+  added->count = 0;
+  added->next = chunk->next;
+  added->prev = chunk;
+  chunk->next->prev = added;
+  chunk->next = added;
+  return added;
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::DeleteChunk(ChunkBase* chunk) {
+  for (int j = 0; j < chunk->count; j++) {
+    AsChunk(chunk)->keys()[j].~Key();
+    AsChunk(chunk)->infos()[j].~Info();
+  }
+  chunk->prev->next = chunk->next;
+  chunk->next->prev = chunk->prev;
+  delete AsChunk(chunk);
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::Split(Chunk* chunk) {
+  // upper half moves to a new chunk after this one
+  Chunk* added = NewChunkAfter(chunk);
+  int half = chunk->count / 2;
+  for (int j = half; j < chunk->count; j++) Relocate(chunk, j, added, j - half);
+  added->count = chunk->count - half;
+  chunk->count = half;
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::InsertAtEnd(const Key& k, const Info& i) {
+  Chunk* last = head_->prev == head_ || head_->prev->count == K
+                    ? NewChunkAfter(head_->prev)
+                    : AsChunk(head_->prev);
+  new (&last->keys()[last->count]) Key(k);
+  new (&last->infos()[last->count]) Info(i);
+  last->count++;
+  length_++;
+}
+
+template <typename Key, typename Info, int K>
+typename UnrolledRing<Key, Info, K>::Iterator
+UnrolledRing<Key, Info, K>::InsertAfter(Iterator pos, const Key& k,
+                                        const Info& i) {
+  ChunkBase* base = pos.chunk_;
+  int slot = pos.index_ + 1;
+  if (base == head_) {
+    base = head_->next;
+    slot = 0;
+  }
+  Chunk* chunk = base == head_ ? NewChunkAfter(head_) : AsChunk(base);
+  if (chunk->count == K) {
+    Split(chunk);
+    if (slot > chunk->count) {
+      slot -= chunk->count;
+      chunk = AsChunk(chunk->next);
+    }
+  }
+  for (int j = chunk->count; j > slot; j--) Relocate(chunk, j - 1, chunk, j);
+  new (&chunk->keys()[slot]) Key(k);
+  new (&chunk->infos()[slot]) Info(i);
+  chunk->count++;
+  length_++;
+  return Iterator(chunk, slot);
+}
+
+template <typename Key, typename Info, int K>
+typename UnrolledRing<Key, Info, K>::Iterator UnrolledRing<Key, Info, K>::Erase(
+    Iterator it) {
+  if (it.chunk_ == head_) {
+    Warning("UnrolledRing::Erase() Cannot erase the sentinel");
+    return it;
+  }
+  Chunk* chunk = AsChunk(it.chunk_);
+  int slot = it.index_;
+  chunk->keys()[slot].~Key();
+  chunk->infos()[slot].~Info();
+  for (int j = slot + 1; j < chunk->count; j++) {
+    Relocate(chunk, j, chunk, j - 1);
+  }
+  chunk->count--;
+  length_--;
+
+  if (!chunk->count) {
+    ChunkBase* next = chunk->next;
+    DeleteChunk(chunk);
+    return Iterator(next, 0);
+  }
+  if (chunk->count < K / 4 && chunk->next != head_ &&
+      chunk->count + chunk->next->count <= K) {
+    Chunk* next = AsChunk(chunk->next);
+    for (int j = 0; j < next->count; j++) {
+      Relocate(next, j, chunk, chunk->count + j);
+    }
+    chunk->count += next->count;
+    next->count = 0;
+    DeleteChunk(next);
+  }
+  if (slot == chunk->count) return Iterator(chunk->next, 0);
+  return Iterator(chunk, slot);
+}
+
+template <typename Key, typename Info, int K>
+typename UnrolledRing<Key, Info, K>::Iterator UnrolledRing<Key, Info, K>::Find(
+    const Key& k) {
+  for (ChunkBase* base = head_->next; base != head_; base = base->next) {
+    Chunk* chunk = AsChunk(base);
+    for (int j = 0; j < chunk->count; j++) {
+      if (chunk->keys()[j] == k) return Iterator(chunk, j);
+    }
+  }
+  return end();
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::Print() const {
+  if (!this->length_) Warning("Ring is empty");
+
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
+  for (ChunkBase* base = head_->next; base != head_; base = base->next) {
+    Chunk* chunk = AsChunk(base);
+    for (int j = 0; j < chunk->count; j++) {
+      AppendPrinted(writer, chunk->keys()[j], chunk->infos()[j]);
+    }
+  }
+}
+
+template <typename Key, typename Info, int K>
+void UnrolledRing<Key, Info, K>::PrintReverse() const {
+  if (!this->length_) Warning("Ring is empty");
+
+  OstreamSink sink(cout);
+  BufferedWriter writer(sink);
+  for (ChunkBase* base = head_->prev; base != head_; base = base->prev) {
+    Chunk* chunk = AsChunk(base);
+    for (int j = chunk->count; j-- > 0;) {
+      AppendPrinted(writer, chunk->keys()[j], chunk->infos()[j]);
+    }
+  }
+}
+
+template <typename Key, typename Info>
+SpscRing<Key, Info>::SpscRing(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) size *= 2;
+  keys_ = allocator<Key>().allocate(size);
+  infos_ = allocator<Info>().allocate(size);
+  mask_ = size - 1;
+}
+
+template <typename Key, typename Info>
+SpscRing<Key, Info>::~SpscRing() {
+  // no other thread may use the ring any more, so plain loads will do
+  for (size_t j = head_.load(); j != tail_.load(); j++) {
+    keys_[j & mask_].~Key();
+    infos_[j & mask_].~Info();
+  }
+  allocator<Key>().deallocate(keys_, capacity());
+  allocator<Info>().deallocate(infos_, capacity());
+}
+
+template <typename Key, typename Info>
+bool SpscRing<Key, Info>::TryPush(const Key& k, const Info& i) {
+  return PushN(&k, &i, 1) == 1;
+}
+
+template <typename Key, typename Info>
+size_t SpscRing<Key, Info>::PushN(const Key* keys, const Info* infos,
+                                  size_t n) {
+  size_t tail = tail_.load(memory_order_relaxed);
+  if (tail - cached_head_ + n > capacity()) {
+    cached_head_ = head_.load(memory_order_acquire);
+    n = min(n, capacity() - (tail - cached_head_));
+  }
+  for (size_t j = 0; j < n; j++) {
+    new (&keys_[(tail + j) & mask_]) Key(keys[j]);
+    new (&infos_[(tail + j) & mask_]) Info(infos[j]);
+  }
+  // one release store publishes the whole batch
+  if (n) tail_.store(tail + n, memory_order_release);
+  return n;
+}
+
+template <typename Key, typename Info>
+bool SpscRing<Key, Info>::TryPop(Key& k, Info& i) {
+  return PopN(&k, &i, 1) == 1;
+}
+
+template <typename Key, typename Info>
+size_t SpscRing<Key, Info>::PopN(Key* keys, Info* infos, size_t n) {
+  size_t head = head_.load(memory_order_relaxed);
+  if (cached_tail_ - head < n) {
+    cached_tail_ = tail_.load(memory_order_acquire);
+    n = min(n, cached_tail_ - head);
+  }
+  for (size_t j = 0; j < n; j++) {
+    Key& key = keys_[(head + j) & mask_];
+    Info& info = infos_[(head + j) & mask_];
+    keys[j] = move(key);
+    infos[j] = move(info);
+    key.~Key();
+    info.~Info();
+  }
+  if (n) head_.store(head + n, memory_order_release);
+  return n;
+}
+
+template <typename Key, typename Info>
+MpmcRing<Key, Info>::MpmcRing(size_t capacity) {
+  // at least two slots, or a full and an empty slot look the same
+  size_t size = 2;
+  while (size < capacity) size *= 2;
+  slots_ = new Slot[size];
+  for (size_t j = 0; j < size; j++)
+    slots_[j].sequence.store(j, memory_order_relaxed);
+  mask_ = size - 1;
+}
+
+template <typename Key, typename Info>
+MpmcRing<Key, Info>::~MpmcRing() {
+  // with no push or pop in flight every position from head_ to tail_ is full
+  for (size_t pos = head_.load(); pos != tail_.load(); pos++) {
+    slots_[pos & mask_].key()->~Key();
+    slots_[pos & mask_].info()->~Info();
+  }
+  delete[] slots_;
+}
+
+template <typename Key, typename Info>
+bool MpmcRing<Key, Info>::TryPush(const Key& k, const Info& i) {
+  size_t pos = tail_.load(memory_order_relaxed);
+  for (;;) {
+    Slot& slot = slots_[pos & mask_];
+    size_t sequence = slot.sequence.load(memory_order_acquire);
+    ptrdiff_t lap = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+    if (lap == 0) {
+      if (tail_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+        new (slot.key()) Key(k);
+        new (slot.info()) Info(i);
+        slot.sequence.store(pos + 1, memory_order_release);
+        return true;
+      }
+    } else if (lap < 0) {
+      return false;  // full: the slot still holds last lap's element
+    } else {
+      pos = tail_.load(memory_order_relaxed);
+    }
+  }
+}
+
+template <typename Key, typename Info>
+size_t MpmcRing<Key, Info>::PushN(const Key* keys, const Info* infos,
+                                  size_t n) {
+  size_t pushed = 0;
+  while (pushed < n && TryPush(keys[pushed], infos[pushed])) pushed++;
+  return pushed;
+}
+
+template <typename Key, typename Info>
+bool MpmcRing<Key, Info>::TryPop(Key& k, Info& i) {
+  size_t pos = head_.load(memory_order_relaxed);
+  for (;;) {
+    Slot& slot = slots_[pos & mask_];
+    size_t sequence = slot.sequence.load(memory_order_acquire);
+    ptrdiff_t lap = (ptrdiff_t)sequence - (ptrdiff_t)(pos + 1);
+    if (lap == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+        k = move(*slot.key());
+        i = move(*slot.info());
+        slot.key()->~Key();
+        slot.info()->~Info();
+        slot.sequence.store(pos + mask_ + 1, memory_order_release);
+        return true;
+      }
+    } else if (lap < 0) {
+      return false;  // empty: the slot has not been written this lap
+    } else {
+      pos = head_.load(memory_order_relaxed);
+    }
+  }
+}
+
+template <typename Key, typename Info>
+size_t MpmcRing<Key, Info>::PopN(Key* keys, Info* infos, size_t n) {
+  size_t popped = 0;
+  while (popped < n && TryPop(keys[popped], infos[popped])) popped++;
+  return popped;
+}
+
+template <typename Key, typename Info>
+bool LruCache<Key, Info>::Get(const Key& k, Info& i) {
+  auto found = index_.find(k);
+  if (found == index_.end()) {
+    misses_++;
+    return false;
+  }
+  hits_++;
+  ring_.MoveToFront(found->second);
+  i = found->second.get_info();
+  return true;
+}
+
+template <typename Key, typename Info>
+void LruCache<Key, Info>::Put(const Key& k, const Info& i) {
+  auto found = index_.find(k);
+  if (found != index_.end()) {
+    ring_.SetInfo(found->second, i);
+    ring_.MoveToFront(found->second);
+    return;
+  }
+  if (!capacity_) return;
+  if (index_.size() == capacity_) {
+    Position last = --ring_.end();
+    index_.erase(*last);
+    ring_.Erase(last);
+    evictions_++;
+  }
+  index_.emplace(k, ring_.InsertAtFront(k, i));
+}
+
+template <typename Key, typename Info>
+bool LruCache<Key, Info>::Remove(const Key& k) {
+  auto found = index_.find(k);
+  if (found == index_.end()) return false;
+  ring_.Erase(found->second);
+  index_.erase(found);
+  return true;
+}
+
+template <typename Key, typename Info>
+ShardedLruCache<Key, Info>::ShardedLruCache(size_t capacity, size_t shards) {
+  if (!shards) shards = 1;
+  for (size_t j = 0; j < shards; j++) {
+    // spread the remainder so the shard capacities add up to capacity
+    size_t share = capacity / shards + (j < capacity % shards);
+    shards_.emplace_back(new Shard(share));
+  }
+}
+
+template <typename Key, typename Info>
+bool ShardedLruCache<Key, Info>::Get(const Key& k, Info& i) {
+  Shard& shard = ShardFor(k);
+  lock_guard<mutex> guard(shard.lock);
+  return shard.cache.Get(k, i);
+}
+
+template <typename Key, typename Info>
+void ShardedLruCache<Key, Info>::Put(const Key& k, const Info& i) {
+  Shard& shard = ShardFor(k);
+  lock_guard<mutex> guard(shard.lock);
+  shard.cache.Put(k, i);
+}
+
+template <typename Key, typename Info>
+bool ShardedLruCache<Key, Info>::Remove(const Key& k) {
+  Shard& shard = ShardFor(k);
+  lock_guard<mutex> guard(shard.lock);
+  return shard.cache.Remove(k);
+}
+
+template <typename Key, typename Info>
+size_t ShardedLruCache<Key, Info>::size() {
+  size_t total = 0;
+  for (auto& shard : shards_) {
+    lock_guard<mutex> guard(shard->lock);
+    total += shard->cache.size();
+  }
+  return total;
+}
+
+template <typename Key, typename Info>
+size_t ShardedLruCache<Key, Info>::hits() {
+  size_t total = 0;
+  for (auto& shard : shards_) {
+    lock_guard<mutex> guard(shard->lock);
+    total += shard->cache.hits();
+  }
+  return total;
+}
+
+template <typename Key, typename Info>
+size_t ShardedLruCache<Key, Info>::misses() {
+  size_t total = 0;
+  for (auto& shard : shards_) {
+    lock_guard<mutex> guard(shard->lock);
+    total += shard->cache.misses();
+  }
+  return total;
+}
+
+template <typename Key, typename Info>
+size_t ShardedLruCache<Key, Info>::evictions() {
+  size_t total = 0;
+  for (auto& shard : shards_) {
+    lock_guard<mutex> guard(shard->lock);
+    total += shard->cache.evictions();
+  }
+  return total;
+}
+
+int TimerWheel::LevelOf(uint64_t deadline) const {
+  uint64_t differing = deadline ^ now_;
+  int bit = 63;
+  while (bit > 0 && !(differing >> bit)) bit--;
+  return bit / kSlotBits;
+}
+
+TimerWheel::Handle TimerWheel::Schedule(uint64_t deadline,
+                                        const Callback& callback) {
+  if (deadline <= now_) deadline = now_ + 1;
+  int level = LevelOf(deadline);
+  level_size_[level]++;
+  size_++;
+  Ring<uint64_t, Callback>& slot = SlotOf(deadline, level);
+  slot.InsertAtEnd(deadline, callback);
+  return --slot.end();
+}
+
+void TimerWheel::Cancel(Handle handle) {
+  int level = LevelOf(*handle);
+  level_size_[level]--;
+  size_--;
+  SlotOf(*handle, level).Erase(handle);
+}
+
+void TimerWheel::Cascade(int level) {
+  // every timer in the slot now differs from now_ in a lower group only
+  Ring<uint64_t, Callback>& slot = SlotOf(now_, level);
+  while (slot.length()) {
+    Handle timer = slot.begin();
+    int lower = LevelOf(*timer);
+    SlotOf(*timer, lower).Transfer(timer, slot);
+    level_size_[level]--;
+    level_size_[lower]++;
+  }
+}
+
+size_t TimerWheel::Fire() {
+  Ring<uint64_t, Callback>& slot = SlotOf(now_, 0);
+  size_t fired = 0;
+  while (slot.length()) {
+    // unlinked before running, so the callback may schedule or cancel
+    Callback callback = move(slot.begin().get_info());
+    slot.Erase(slot.begin());
+    level_size_[0]--;
+    size_--;
+    callback();
+    fired++;
+  }
+  return fired;
+}
+
+size_t TimerWheel::Advance(uint64_t now) {
+  size_t fired = 0;
+  while (now_ < now) {
+    int lowest = 0;
+    while (lowest < kLevels && !level_size_[lowest]) lowest++;
+    if (lowest == kLevels) {
+      now_ = now;
+      break;
+    }
+    if (lowest > 0) {
+      // nothing can happen before the next slot boundary of that level
+      int shift = lowest * kSlotBits;
+      uint64_t boundary = ((now_ >> shift) + 1) << shift;
+      if (boundary > now || boundary == 0) {
+        now_ = now;
+        break;
+      }
+      now_ = boundary - 1;
+    }
+    now_++;
+    for (int level = kLevels - 1; level > 0; level--) {
+      if (!(now_ & ((uint64_t(1) << (level * kSlotBits)) - 1))) {
+        Cascade(level);
+      }
+    }
+    fired += Fire();
+  }
+  return fired;
+}
+
 void Warning(string s) {
   cout << "\033[94m"
        << "Warning: "
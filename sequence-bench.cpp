@@ -0,0 +1,42 @@
+// Scaling benchmark of Sequence::AddNode and RemoveNode from 10^3 elements up
+// to 10^7. With the key index both stay O(1) expected, so the time per
+// element should stay flat as n grows; without it (Sequence(false)) every
+// call walks the list, which is measured up to 10^4 elements only.
+// Build: g++ -std=c++17 -O2 -pthread sequence-bench.cpp
+// Usage: ./a.out [max n]
+
+#define LINKED_LIST_NO_MAIN
+#include "linked-list.cpp"
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+const size_t kMaxUnindexed = 10000;
+
+// Builds a sequence of n keys, then removes them in random order
+void Benchmark(size_t n, bool index_keys) {
+  vector<int> keys(n);
+  for (size_t i = 0; i < n; i++) keys[i] = int(i * 2654435761u % n);
+  Sequence<int, int> sequence(index_keys);
+  double add = NanosecondsPerOp(n, [&] {
+    for (int key : keys) sequence.AddNode(key, key);
+  });
+  shuffle(keys.begin(), keys.end(), mt19937(42));
+  double remove = NanosecondsPerOp(n, [&] {
+    for (int key : keys) sequence.RemoveNode(key);
+  });
+  if (sequence.length()) printf("nodes were left behind!\n");
+  printf("n=%-9zu %-9s AddNode %8.1f ns/element  RemoveNode %8.1f ns/element\n",
+         n, index_keys ? "indexed" : "unindexed", add, remove);
+}
+
+int main(int argc, char** argv) {
+  size_t max_n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+  for (size_t n = 1000; n <= max_n; n *= 10) {
+    Benchmark(n, true);
+    if (n <= kMaxUnindexed) Benchmark(n, false);
+  }
+}
@@ -0,0 +1,91 @@
+/** Multi-threaded throughput benchmark of ShardedDictionary
+ Every thread runs a mix of find, insert and remove on random keys of a
+ dictionary preloaded with half of the key space. The ShardedDictionary with
+ 16 shards is compared with one Dictionary behind a single reader-writer
+ lock, for each thread count and read ratio.
+ Build: g++ -std=c++17 -O2 -pthread sharded-bench.cpp
+ Usage: ./a.out [operations per thread] [max threads]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <random>
+
+constexpr int kKeySpace = 1 << 20;
+
+// One Dictionary under one lock, how the dictionary was shared before
+class LockedDictionary {
+public:
+    void insert(int key, int info)
+    {
+        unique_lock<shared_mutex> guard(lock_);
+        dictionary_.insert(key, info);
+    }
+
+    void remove(int key)
+    {
+        unique_lock<shared_mutex> guard(lock_);
+        dictionary_.remove(key);
+    }
+
+    bool find(int key, int& info) const
+    {
+        shared_lock<shared_mutex> guard(lock_);
+        const int* found = dictionary_.find(key);
+        if (found)
+            info = *found;
+        return found;
+    }
+
+private:
+    mutable shared_mutex lock_;
+    Dictionary<int, int> dictionary_;
+};
+
+// million operations per second over all threads
+template <typename Map>
+double throughput(Map& map, int threads, size_t operations, int readPercent)
+{
+    for (int key = 0; key < kKeySpace; key += 2)
+        map.insert(key, key);
+    double time = NanosecondsPerOp(threads * operations, [&] {
+        vector<thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&map, t, operations, readPercent] {
+                mt19937 random(t);
+                int info;
+                for (size_t i = 0; i < operations; i++) {
+                    int key = random() % kKeySpace;
+                    int dice = random() % 100;
+                    if (dice < readPercent)
+                        map.find(key, info);
+                    else if (dice % 2)
+                        map.insert(key, key);
+                    else
+                        map.remove(key);
+                }
+            });
+        }
+        for (thread& worker : workers)
+            worker.join();
+    });
+    return 1e3 / time;
+}
+
+int main(int argc, char** argv)
+{
+    size_t operations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    int maxThreads = argc > 2 ? atoi(argv[2]) : 8;
+    printf("%u hardware threads, %zu operations per thread\n", thread::hardware_concurrency(), operations);
+    for (int readPercent : { 50, 90, 99 }) {
+        for (int threads = 1; threads <= maxThreads; threads *= 2) {
+            ShardedDictionary<int, int, 16> sharded;
+            LockedDictionary locked;
+            double shardedRate = throughput(sharded, threads, operations, readPercent);
+            double lockedRate = throughput(locked, threads, operations, readPercent);
+            printf("reads %2d%%  threads %2d   ShardedDictionary %6.2f Mops/s   one lock %6.2f Mops/s\n", readPercent, threads, shardedRate, lockedRate);
+        }
+    }
+}
@@ -0,0 +1,106 @@
+/** Benchmark of the Dictionary stats policies
+ Times insert, find and remove of n random keys with the default NoStats
+ policy, whose hooks are empty, and with DictionaryStats, next to std::map as
+ a tree that has no hooks at all. Each figure is the best of several rounds,
+ so that NoStats can be checked to cost nothing.
+ Build: g++ -std=c++17 -O2 -pthread stats-bench.cpp
+ Usage: ./a.out [n] [rounds]
+**/
+
+#define AVL_TREE_NO_MAIN
+#include "avl-tree.cpp"
+#include "bench.h"
+
+#include <map>
+#include <random>
+
+struct Timings {
+    double insert = 1e300;
+    double find = 1e300;
+    double remove = 1e300;
+};
+
+template <typename Function>
+void keepFastest(double& best, size_t ops, Function fn)
+{
+    best = min(best, NanosecondsPerOp(ops, fn));
+}
+
+template <typename Map>
+void runRound(Timings& timings, const vector<int>& keys, const vector<int>& probes)
+{
+    Map map;
+    size_t found = 0;
+    keepFastest(timings.insert, keys.size(), [&] {
+        for (int key : keys)
+            map.insert({ key, key });
+    });
+    keepFastest(timings.find, probes.size(), [&] {
+        for (int key : probes)
+            found += map.find(key) != map.end();
+    });
+    keepFastest(timings.remove, keys.size(), [&] {
+        for (int key : probes)
+            map.erase(key);
+    });
+    if (found != probes.size())
+        printf("lookups missed keys!\n");
+}
+
+// Dictionary with the member names round() uses for std::map
+template <typename Stats>
+class Adapter {
+public:
+    void insert(pair<int, int> entry)
+    {
+        dictionary_.insert(entry.first, entry.second);
+    }
+
+    const int* find(int key) const
+    {
+        return dictionary_.find(key);
+    }
+
+    const int* end() const
+    {
+        return nullptr;
+    }
+
+    void erase(int key)
+    {
+        dictionary_.remove(key);
+    }
+
+private:
+    Dictionary<int, int, NodePool, Stats> dictionary_;
+};
+
+void print(const char* name, const Timings& timings, size_t bytes)
+{
+    printf("%-16s insert %7.1f  find %7.1f  remove %7.1f ns/op   sizeof %zu\n", name, timings.insert, timings.find, timings.remove, bytes);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    mt19937 random(42);
+    vector<int> keys(n);
+    for (size_t i = 0; i < n; i++)
+        keys[i] = static_cast<int>(i);
+    shuffle(keys.begin(), keys.end(), random);
+    vector<int> probes = keys;
+    shuffle(probes.begin(), probes.end(), random);
+
+    Timings noStats, dictionaryStats, reference;
+    // interleaved, so drift in the machine's speed hits all three alike
+    for (int i = 0; i < rounds; i++) {
+        runRound<Adapter<NoStats>>(noStats, keys, probes);
+        runRound<Adapter<DictionaryStats>>(dictionaryStats, keys, probes);
+        runRound<map<int, int>>(reference, keys, probes);
+    }
+    printf("n=%zu, best of %d rounds\n", n, rounds);
+    print("NoStats", noStats, sizeof(Dictionary<int, int, NodePool, NoStats>));
+    print("DictionaryStats", dictionaryStats, sizeof(Dictionary<int, int, NodePool, DictionaryStats>));
+    print("std::map", reference, sizeof(map<int, int>));
+}